@@ -0,0 +1,212 @@
+// Compare the BVH builders: build time against the traversal cost of the
+// trees they produce, traversed as binary trees, collapsed to 4 and 8
+// children per node, and as compressed nodes of 8 children ("8c"), along
+// with the bytes of nodes traversal reads per triangle.
+//
+// Usage: bvh_benchmark [mesh.stl|N ...] [--rays N] [--threads N]
+//   Each mesh is an .stl file or a number of triangles of a synthetic mesh
+//   (a bumpy sphere). Without meshes, the bundled bunny, skull and frame
+//   and synthetic meshes of one and four million triangles are used.
+#include "BVH.h"
+#include "HitRecord.h"
+#include "Ray.h"
+#include "TriangleMesh.h"
+#include "TriangleSoup.h"
+#include "read_stl.h"
+#include "weld_vertices.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef BVH_BENCHMARK_DATA_DIR
+#define BVH_BENCHMARK_DATA_DIR "data/"
+#endif
+
+namespace
+{
+  // Sphere of radius about 1 with ripples, triangulated on a latitude and
+  // longitude grid
+  //
+  // Inputs:
+  //   num_triangles  approximate number of triangles
+  // Outputs:
+  //   mesh  mesh with vertices and faces filled in (not built)
+  void bumpy_sphere(const int num_triangles, TriangleMesh & mesh)
+  {
+    const double PI = 3.14159265358979323846;
+    const int n = std::max<int>(std::sqrt(num_triangles/2.0),2);
+    mesh.vertices.clear();
+    mesh.faces.clear();
+    for(int i = 0;i<=n;i++)
+    {
+      const double theta = PI*i/n;
+      for(int j = 0;j<n;j++)
+      {
+        const double phi = 2*PI*j/n;
+        const double r = 1 + 0.1*std::sin(17*theta)*std::sin(13*phi);
+        mesh.vertices.emplace_back(
+          r*std::sin(theta)*std::cos(phi),
+          r*std::cos(theta),
+          r*std::sin(theta)*std::sin(phi));
+      }
+    }
+    for(int i = 0;i<n;i++)
+    {
+      for(int j = 0;j<n;j++)
+      {
+        const std::uint32_t a = i*n + j;
+        const std::uint32_t b = i*n + (j+1)%n;
+        const std::uint32_t c = a + n;
+        const std::uint32_t d = b + n;
+        mesh.faces.insert(mesh.faces.end(),{a,c,b,b,c,d});
+      }
+    }
+  }
+
+  // Rays from a sphere around the mesh towards random points in its box
+  std::vector<Ray> random_rays(const TriangleMesh & mesh, const int num_rays)
+  {
+    Eigen::AlignedBox3d box;
+    for(const Eigen::Vector3d & vertex : mesh.vertices)
+    {
+      box.extend(vertex);
+    }
+    const double radius = box.sizes().norm();
+    std::mt19937 generator(317);
+    std::normal_distribution<double> normal;
+    std::uniform_real_distribution<double> uniform;
+    std::vector<Ray> rays(num_rays);
+    for(Ray & ray : rays)
+    {
+      const Eigen::Vector3d out =
+        Eigen::Vector3d(normal(generator),normal(generator),normal(generator))
+        .normalized();
+      const Eigen::Vector3d target =
+        box.min() + box.sizes().cwiseProduct(Eigen::Vector3d(
+          uniform(generator),uniform(generator),uniform(generator)));
+      ray.origin = box.center() + radius*out;
+      ray.direction = target - ray.origin;
+    }
+    return rays;
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  // Nodes and triangles per ray come from the traversal statistics
+  BVH::set_collect_stats(true);
+  std::vector<std::string> meshes;
+  int num_rays = 200000;
+  int num_threads = std::max<int>(std::thread::hardware_concurrency(),1);
+  for(int a = 1;a<argc;a++)
+  {
+    const std::string arg = argv[a];
+    if(arg == "--rays" && a+1<argc)
+    {
+      num_rays = std::atoi(argv[++a]);
+    }else if(arg == "--threads" && a+1<argc)
+    {
+      num_threads = std::atoi(argv[++a]);
+    }else
+    {
+      meshes.push_back(arg);
+    }
+  }
+  if(meshes.empty())
+  {
+    meshes = {
+      BVH_BENCHMARK_DATA_DIR "bunny.stl",
+      BVH_BENCHMARK_DATA_DIR "skull.stl",
+      BVH_BENCHMARK_DATA_DIR "frame.stl",
+      "1000000",
+      "4000000"};
+  }
+  // Single threaded, and with all threads (if there are several)
+  std::vector<int> thread_counts = {1};
+  if(num_threads > 1)
+  {
+    thread_counts.push_back(num_threads);
+  }
+
+  std::printf("%-12s %9s %-11s %7s %10s %9s %6s %7s %9s %9s %8s\n",
+    "mesh","triangles","builder","threads","build ms","SAH cost","layout",
+    "B/tri","nodes/ray","tris/ray","Mrays/s");
+  for(const std::string & name : meshes)
+  {
+    TriangleMesh source;
+    if(name.find_first_not_of("0123456789") == std::string::npos)
+    {
+      bumpy_sphere(std::atoi(name.c_str()),source);
+    }else
+    {
+      std::vector<Eigen::Vector3d> corners;
+      if(!read_stl(name,corners))
+      {
+        std::cerr<<"Error: could not read "<<name<<std::endl;
+        return EXIT_FAILURE;
+      }
+      weld_vertices(corners,source.vertices,source.faces);
+    }
+    const std::vector<Ray> rays = random_rays(source,num_rays);
+    const std::string label = name.substr(name.find_last_of("/\\")+1);
+
+    for(const BVH::BuildMethod method :
+      {BVH::BINNED_SAH,BVH::MORTON,BVH::SPATIAL_SAH})
+    {
+      for(const int threads : thread_counts)
+      {
+        std::shared_ptr<TriangleMesh> mesh(new TriangleMesh(source));
+        mesh->build(method,threads);
+
+        TriangleSoup soup;
+        soup.mesh = mesh;
+        // Widths, with 0 for compressed nodes
+        for(const int width : {2,4,8,0})
+        {
+          BVH & bvh = mesh->bvh;
+          if(width > 0)
+          {
+            bvh.collapse(width);
+          }else if(!bvh.compress())
+          {
+            continue;
+          }
+          bvh.reset_traversal_stats();
+          const auto start = std::chrono::steady_clock::now();
+          for(const Ray & ray : rays)
+          {
+            HitRecord record;
+            soup.hit(ray,0,std::numeric_limits<double>::infinity(),record);
+          }
+          const double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+          const double traced = std::max<double>(bvh.traversal_stats.rays,1);
+          std::printf(
+            "%-12s %9d %-11s %7d %10.1f %9.2f %6s %7.1f %9.1f %9.1f %8.2f\n",
+            label.c_str(),source.size(),
+            BVH::method_name(method),
+            threads,
+            bvh.build_stats.build_ms,
+            bvh.build_stats.sah_cost,
+            width > 0 ? std::to_string(width).c_str() : "8c",
+            (double)bvh.traversal_size()/source.size(),
+            bvh.traversal_stats.node_visits/traced,
+            bvh.traversal_stats.primitive_tests/traced,
+            rays.size()/seconds/1e6);
+        }
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
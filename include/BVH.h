@@ -0,0 +1,1069 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "Ray.h"
+#include "RayPacket.h"
+#include "simd_kernels.h"
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Forward declaration
+struct BinaryReader;
+
+// Bounding volume hierarchy over a list of axis-aligned bounding boxes. The
+// hierarchy only knows about boxes and primitive indices; intersecting the
+// primitives themselves is left to a callback supplied at traversal time, so
+// the same tree can accelerate triangles in a soup or objects in a scene.
+//
+// Nodes are stored depth-first in a flat array: the first child of an inner
+// node immediately follows it, the second child is at `offset`.
+//
+// For traversal the binary tree is also collapsed into a wide one (see
+// collapse) whose nodes hold 4 or 8 children, all tested against a ray by one
+// SIMD slab test. Wide nodes reuse the binary leaves (ranges of indices), so
+// traversal callbacks see no difference. For hierarchies too big for the
+// caches the wide nodes can instead be compressed (see compress), storing
+// child boxes as bytes relative to their parent's box. Packets of coherent
+// rays walk the binary tree together (see closest_hit_packet_leaves).
+class BVH
+{
+  public:
+    // How build splits primitives
+    enum BuildMethod
+    {
+      // Binned surface area heuristic: best trees, slower to build
+      BINNED_SAH = 0,
+      // Split at the bits of the Morton codes of primitive centers sorted
+      // along a space filling curve (linear BVH): several times faster to
+      // build, for meshes rebuilt often, at some cost in traversal
+      MORTON = 1,
+      // Binned SAH that may also split space, so that a primitive straddling
+      // the plane is referenced (clipped) on both sides (SBVH). Fewer
+      // overlapping nodes for meshes of long, thin or slanted triangles, at
+      // the cost of building time and of up to 30% more references than
+      // primitives
+      SPATIAL_SAH = 2
+    };
+    // Bound the parts of a primitive on either side of an axis-aligned plane
+    // (see split_triangle): `split(primitive, axis, position, left, right)`
+    // sets left and right to boxes around the parts with coordinate <=
+    // position and >= position along axis. Called concurrently.
+    typedef std::function<void(
+      const int primitive,
+      const int axis,
+      const double position,
+      Eigen::AlignedBox3d & left,
+      Eigen::AlignedBox3d & right)> SplitFunction;
+    struct Node
+    {
+      Eigen::AlignedBox3d box;
+      // Leaves: index of first primitive in `indices`
+      // Inner nodes: index of second child in `nodes`
+      int offset;
+      // Number of primitives in a leaf (0 for inner nodes)
+      int count;
+    };
+    // Build-time statistics
+    struct BuildStats
+    {
+      BuildMethod method = BINNED_SAH;
+      double build_ms = 0;
+      int num_primitives = 0;
+      // Entries in indices (more than primitives after spatial splits)
+      int num_references = 0;
+      int num_nodes = 0;
+      int num_leaves = 0;
+      int max_depth = 0;
+      // Expected cost of the tree according to the surface area heuristic
+      double sah_cost = 0;
+    };
+    // Wide copy of the tree. Node i has sizes[i] children in slots
+    // [i*width, i*width+sizes[i]), packed at the front.
+    struct WideNodes
+    {
+      // Children per node (0 if there is no wide tree)
+      int width = 0;
+      // Child boxes: for node i, 6 arrays of width values (min x,y,z, max
+      // x,y,z) starting at bounds[6*width*i], padded at the end for full
+      // vector loads
+      std::vector<double> bounds;
+      // Per slot: index of the child's wide node, or for a leaf its first
+      // position in indices
+      std::vector<int> children;
+      // Per slot: number of primitives of a leaf, 0 for an inner node
+      std::vector<int> counts;
+      // Per node: number of children
+      std::vector<int> sizes;
+      // Per slot: binary node the child was copied from
+      std::vector<int> sources;
+    };
+    // Children of a compressed node
+    static const int COMPRESSED_WIDTH = SIMD_MAX_LANES;
+    // Wide node with child boxes quantized to 8 bits per coordinate. The
+    // boxes are rounded outwards, so they contain the exact ones.
+    struct CompressedNode
+    {
+      // Child coordinate on axis a is origin[a] + q*scale[a] for its byte q
+      // (scale is a power of two, so only the sum rounds)
+      float origin[3];
+      float scale[3];
+      // Min x,y,z and max x,y,z of every child
+      std::uint8_t bounds[6][COMPRESSED_WIDTH];
+      // Per child: index of its compressed node, or for a leaf its first
+      // position in indices
+      std::uint32_t children[COMPRESSED_WIDTH];
+      // Per child: number of primitives of a leaf, 0 for an inner node
+      std::uint8_t counts[COMPRESSED_WIDTH];
+      // Number of children
+      std::uint8_t size;
+    };
+    // Traversal statistics, accumulated over all queries since the last reset
+    // while collect_stats() is on (queries count in locals and only publish
+    // their totals here, so that render threads do not contend for these
+    // counters unless statistics were asked for)
+    struct TraversalStats
+    {
+      std::atomic<std::uint64_t> rays{0};
+      std::atomic<std::uint64_t> node_visits{0};
+      std::atomic<std::uint64_t> primitive_tests{0};
+      // Packets traced (see closest_hit_packet_leaves), their rays and the
+      // nodes they visited as a whole
+      std::atomic<std::uint64_t> packets{0};
+      std::atomic<std::uint64_t> packet_rays{0};
+      std::atomic<std::uint64_t> packet_node_visits{0};
+      // Sum over packet node visits of the packet size and of the rays still
+      // in range: their ratio is the packet utilization
+      std::atomic<std::uint64_t> packet_slots{0};
+      std::atomic<std::uint64_t> packet_active{0};
+      // Subtrees that a packet ray finished on its own
+      std::atomic<std::uint64_t> packet_fallbacks{0};
+    };
+
+    std::vector<Node> nodes;
+    // Primitive indices, ordered so that every leaf covers a contiguous range
+    // (a primitive may appear in several leaves after spatial splits)
+    std::vector<int> indices;
+    BuildStats build_stats;
+    WideNodes wide;
+    // Compressed wide tree (empty unless compress was called)
+    std::vector<CompressedNode> compressed;
+    mutable TraversalStats traversal_stats;
+
+    BVH() {}
+    BVH(const BVH & other);
+    BVH & operator=(const BVH & other);
+
+    // Build the hierarchy (and collapse it to default_width()). Large
+    // subtrees are built on other threads; the result does not depend on the
+    // number of threads.
+    //
+    // Inputs:
+    //   boxes  #boxes list of primitive bounding boxes
+    //   max_leaf_size  leaves are only forced to split above this many
+    //     primitives, below it a leaf is kept whenever SAH finds no cheaper
+    //     split (MORTON splits every leaf above it)
+    //   method  how to split primitives
+    //   num_threads  number of threads to build with (0 for hardware
+    //     concurrency)
+    //   split  for SPATIAL_SAH, bounds the parts of a primitive on either
+    //     side of a plane (by default the primitive's box is cut instead,
+    //     which is looser)
+    void build(
+      const std::vector<Eigen::AlignedBox3d> & boxes,
+      const int max_leaf_size = 4,
+      const BuildMethod method = BINNED_SAH,
+      const int num_threads = 0,
+      const SplitFunction & split = SplitFunction());
+    // Grow or shrink the boxes of the nodes above moved primitives, keeping
+    // the topology. Only the paths from the affected leaves to the root are
+    // visited, but the tree degrades as primitives drift away from the ones
+    // they were grouped with (compare sah_cost() to build_stats.sah_cost to
+    // decide when to rebuild). Not for SPATIAL_SAH trees, whose boxes are
+    // clipped to the old geometry. On a compressed tree only the compressed
+    // nodes on those paths are requantized.
+    //
+    // Inputs:
+    //   boxes  #boxes list of primitive bounding boxes, same primitives (and
+    //     count) as the last build
+    //   moved  indices into boxes of the primitives whose boxes changed
+    // Returns false if a compressed tree lost its compression because a new
+    //   box no longer fits a float (traversal then uses wide nodes of
+    //   default_width())
+    bool refit(
+      const std::vector<Eigen::AlignedBox3d> & boxes,
+      const std::vector<int> & moved);
+    // Returns expected cost of the tree in its current state according to
+    // the surface area heuristic
+    double sah_cost() const;
+    // Name of a build method, as printed in statistics
+    static const char * method_name(const BuildMethod method);
+    // Collapse the binary tree into nodes of up to `width` children, by
+    // repeatedly opening the inner child with the largest surface area.
+    // Traversal then uses the wide nodes.
+    //
+    // Inputs:
+    //   width  children per wide node, 4 or 8 (2 drops the wide tree and
+    //     traverses the binary one)
+    void collapse(const int width);
+    // Width that build and read collapse to (2, 4 or 8; initially 8)
+    static int default_width();
+    static void set_default_width(const int width);
+    // Whether queries add to traversal_stats (initially false)
+    static bool collect_stats()
+    {
+      return stats_enabled.load(std::memory_order_relaxed);
+    }
+    static void set_collect_stats(const bool collect);
+    // Replace the wide nodes by compressed nodes of COMPRESSED_WIDTH
+    // children, about a quarter of the size, which traversal then uses (at
+    // the cost of dequantizing boxes and of looser boxes). Kept through
+    // refit (unless it returns false); build, read and collapse drop it.
+    //
+    // Returns true on success, false if a leaf holds more than 255
+    // primitives or the boxes do not fit a float (the layout is then left
+    // unchanged)
+    bool compress();
+    // Returns true iff traversal uses compressed nodes
+    bool is_compressed() const { return !compressed.empty(); }
+    // Bytes of memory held by the hierarchy
+    std::size_t memory_size() const;
+    // Bytes of the nodes that traversal reads (binary, wide or compressed)
+    std::size_t traversal_size() const;
+    // Returns true iff the hierarchy holds no primitives
+    bool empty() const { return nodes.empty(); }
+    // Find the closest primitive hit along a ray. Leaves are visited front to
+    // back and subtrees beyond the current closest hit are skipped.
+    //
+    // Inputs:
+    //   ray  ray along which to search
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider
+    //   leaf  callable `bool leaf(int primitive, double & max_t)` that
+    //     intersects one primitive, and on a hit closer than max_t shrinks
+    //     max_t to it and returns true
+    // Outputs:
+    //   max_t  parametric distance of closest hit (unchanged if none)
+    // Returns true iff any call to leaf returned true
+    template <typename LeafFunc>
+    bool closest_hit(
+      const Ray & ray,
+      const double min_t,
+      double & max_t,
+      LeafFunc && leaf) const;
+    // Same as closest_hit, but hand whole leaves to the callback so that it
+    // can test their primitives as a batch.
+    //
+    // Inputs:
+    //   leaf  callable `bool leaf(int begin, int end, double & max_t)` that
+    //     intersects the primitives indices[begin,end) and on a hit closer
+    //     than max_t shrinks max_t to it and returns true
+    template <typename LeafFunc>
+    bool closest_hit_leaves(
+      const Ray & ray,
+      const double min_t,
+      double & max_t,
+      LeafFunc && leaf) const;
+    // Find the closest primitive hit along every ray of a packet of coherent
+    // rays (e.g., viewing rays of neighbouring pixels). The packet walks the
+    // binary tree as a whole, carrying the range of its rays that may still
+    // hit a node, narrowed to the first and last ray that do (Overbeck,
+    // Ramamoorthi and Mark, "Large Ray Packets for Real-time Whitted Ray
+    // Tracing", 2008). Nodes that interval bounds over all rays of the packet
+    // show to be missed by every ray are skipped without testing any of them.
+    // Once a range is narrower than bvh_detail::PACKET_MIN_RAYS the packet has
+    // diverged, and each of its rays finishes the subtree on its own.
+    //
+    // Inputs:
+    //   packet  rays along which to search
+    //   min_t  minimum parametric distance to consider
+    //   max_t  packet.size maximum parametric distances to consider, one per
+    //     ray
+    //   leaf  callable `bool leaf(int begin, int end, int first, int last,
+    //     double * max_t)` that intersects the primitives indices[begin,end)
+    //     with the rays [first,last) of the packet (some of which may miss
+    //     the leaf's box), shrinks max_t of every ray hitting one closer and
+    //     returns true iff any did
+    // Outputs:
+    //   max_t  parametric distance of closest hit of every ray (unchanged if
+    //     none)
+    // Returns true iff any call to leaf returned true
+    template <typename LeafFunc>
+    bool closest_hit_packet_leaves(
+      const RayPacket & packet,
+      const double min_t,
+      double * max_t,
+      LeafFunc && leaf) const;
+    // Determine whether any primitive is hit along a ray segment. Traversal
+    // stops at the first primitive that reports a hit, in no particular
+    // order.
+    //
+    // Inputs:
+    //   ray  ray along which to search
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider
+    //   leaf  callable `bool leaf(int primitive)` returning true iff the
+    //     primitive is hit within [min_t, max_t]
+    // Returns true iff any call to leaf returned true
+    template <typename LeafFunc>
+    bool any_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      LeafFunc && leaf) const;
+    // Same as any_hit, but hand whole leaves to the callback.
+    //
+    // Inputs:
+    //   leaf  callable `bool leaf(int begin, int end)` returning true iff
+    //     any of the primitives indices[begin,end) is hit
+    template <typename LeafFunc>
+    bool any_hit_leaves(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      LeafFunc && leaf) const;
+    // Append the hierarchy to a binary buffer (see binary_io.h)
+    void write(std::string & buffer) const;
+    // Replace the hierarchy with one appended by write (and collapse it to
+    // default_width()).
+    //
+    // Inputs:
+    //   reader  reader positioned at the data
+    // Outputs:
+    //   reader  positioned after the data
+    // Returns true on success, false if the data is truncated or does not
+    //   describe a valid tree (the hierarchy is then left empty)
+    bool read(BinaryReader & reader);
+    // Zero the traversal counters
+    void reset_traversal_stats() const;
+    // Print build and traversal statistics
+    void print_stats(std::ostream & os) const;
+  private:
+    static std::atomic<bool> stats_enabled;
+    // Sum of the SAH weighted half areas of all nodes (sah_cost without the
+    // division by the root area), kept up to date by refit
+    double weighted_area = 0;
+    // Per compressed child: binary node it was collapsed from (like
+    // wide.sources)
+    std::vector<int> compressed_sources;
+    // Parent of every node (-1 for the root), leaf of every primitive and
+    // slot of every node in the wide or compressed nodes (-1 if none), set
+    // up by the first refit after a build
+    std::vector<int> parents;
+    std::vector<int> leaves;
+    std::vector<int> wide_slots;
+
+    // Add the counts of one query to traversal_stats if collect_stats()
+    void count_traversal(
+      const std::uint64_t rays,
+      const std::uint64_t visits,
+      const std::uint64_t tests) const
+    {
+      if(collect_stats())
+      {
+        traversal_stats.rays.fetch_add(rays,std::memory_order_relaxed);
+        traversal_stats.node_visits.fetch_add(
+          visits,std::memory_order_relaxed);
+        traversal_stats.primitive_tests.fetch_add(
+          tests,std::memory_order_relaxed);
+      }
+    }
+    // Closest hit search of one ray in the binary subtree below node root,
+    // adding the nodes it visits and primitives it tests to visits and tests
+    template <typename LeafFunc>
+    bool subtree_closest_hit_leaves(
+      const int root,
+      const Ray & ray,
+      const Eigen::Vector3d & inv_direction,
+      const double min_t,
+      double & max_t,
+      LeafFunc && leaf,
+      std::uint64_t & visits,
+      std::uint64_t & tests) const;
+    // Wide traversal, over wide or compressed nodes (see bvh_detail)
+    template <typename WideView, typename LeafFunc>
+    bool wide_closest_hit_leaves(
+      const WideView & view,
+      const Ray & ray,
+      const double min_t,
+      double & max_t,
+      LeafFunc && leaf) const;
+    template <typename WideView, typename LeafFunc>
+    bool wide_any_hit_leaves(
+      const WideView & view,
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      LeafFunc && leaf) const;
+};
+
+// Slab test of a ray against a box. `inv_direction` is the componentwise
+// inverse of the ray direction. NaNs (from 0*inf on a slab boundary) fail
+// every comparison and are therefore ignored.
+//
+// Inputs:
+//   box  box to test against
+//   origin  ray origin
+//   inv_direction  componentwise inverse of ray direction
+//   min_t  minimum parametric distance to consider
+//   max_t  maximum parametric distance to consider
+// Outputs:
+//   t_enter  parametric distance at which the ray enters the box
+// Returns true iff the ray overlaps the box within [min_t, max_t]
+inline bool ray_box_intersect(
+  const Eigen::AlignedBox3d & box,
+  const Eigen::Vector3d & origin,
+  const Eigen::Vector3d & inv_direction,
+  const double min_t,
+  const double max_t,
+  double & t_enter)
+{
+  double t0 = min_t;
+  double t1 = max_t;
+  for(int a = 0;a<3;a++)
+  {
+    double t_near = (box.min()(a) - origin(a)) * inv_direction(a);
+    double t_far = (box.max()(a) - origin(a)) * inv_direction(a);
+    if(t_near > t_far) std::swap(t_near,t_far);
+    // Pad the exit so that rounding never rejects a primitive lying exactly
+    // on the box boundary (Ize, "Robust BVH Ray Traversal", 2013)
+    t_far *= 1.0 + 4.0 * std::numeric_limits<double>::epsilon();
+    if(t_near > t0) t0 = t_near;
+    if(t_far < t1) t1 = t_far;
+  }
+  t_enter = t0;
+  return t0 <= t1;
+}
+
+// Implementation
+
+// Helpers of the wide traversal (see wide_closest_hit_leaves) and of packet
+// traversal (see closest_hit_packet_leaves)
+namespace bvh_detail
+{
+  const int WIDE_STACK_SIZE = 64*(SIMD_MAX_LANES-1) + 1;
+  struct WideEntry
+  {
+    // Wide node, or first position in indices of a leaf
+    int child;
+    // Number of primitives of a leaf, 0 for a wide node
+    int count;
+    double t;
+  };
+
+  // Access to the children of wide nodes: slab test of all children of a
+  // node, and the child (see WideEntry) in each slot
+  struct WideView
+  {
+    const BVH::WideNodes & wide;
+
+    int hits(
+      const SimdKernels & kernels,
+      const SimdRay & ray,
+      const double min_t,
+      const double max_t,
+      const int node,
+      double * t_enter) const
+    {
+      const double * node_bounds = wide.bounds.data() + 6*wide.width*node;
+      const double * bounds[6];
+      for(int a = 0;a<6;a++)
+      {
+        bounds[a] = node_bounds + a*wide.width;
+      }
+      return kernels.box_hits(
+        ray,min_t,max_t,bounds,wide.sizes[node],t_enter);
+    }
+    int child(const int node, const int slot) const
+    {
+      return wide.children[node*wide.width+slot];
+    }
+    int count(const int node, const int slot) const
+    {
+      return wide.counts[node*wide.width+slot];
+    }
+  };
+  struct CompressedView
+  {
+    const BVH::CompressedNode * nodes;
+
+    int hits(
+      const SimdKernels & kernels,
+      const SimdRay & ray,
+      const double min_t,
+      const double max_t,
+      const int node,
+      double * t_enter) const
+    {
+      const BVH::CompressedNode & n = nodes[node];
+      return kernels.quantized_box_hits(
+        ray,min_t,max_t,n.origin,n.scale,n.bounds[0],n.size,t_enter);
+    }
+    int child(const int node, const int slot) const
+    {
+      return nodes[node].children[slot];
+    }
+    int count(const int node, const int slot) const
+    {
+      return nodes[node].counts[slot];
+    }
+  };
+
+  // Fewest rays a packet keeps tracing together
+  const int PACKET_MIN_RAYS = 4;
+  struct PacketEntry
+  {
+    int node;
+    // Range of packet rays that may hit the node
+    int first, last;
+  };
+  // Bounds over all rays of a packet of their origins and of the inverses of
+  // their directions, per axis. Axes on which some ray has a zero direction
+  // component are not finite.
+  struct PacketBounds
+  {
+    double origin_min[3], origin_max[3];
+    double inv_min[3], inv_max[3];
+    bool finite[3];
+  };
+
+  // Slab test of a whole packet in interval arithmetic: the extreme
+  // products of the bounds bound each ray's slab distances, as computed by
+  // ray_box_intersect, since rounding is monotone (Boulos et al., "Packet-
+  // based Whitted and Distribution Ray Tracing", 2007).
+  //
+  // Inputs:
+  //   bounds  bounds of the packet's rays
+  //   box  box to test against
+  //   min_t  minimum parametric distance to consider
+  //   max_t  largest maximum parametric distance of the packet's rays
+  // Returns false only if no ray of the packet hits the box
+  inline bool packet_may_hit(
+    const PacketBounds & bounds,
+    const Eigen::AlignedBox3d & box,
+    const double min_t,
+    const double max_t)
+  {
+    double t0 = min_t;
+    double t1 = max_t;
+    for(int a = 0;a<3;a++)
+    {
+      if(!bounds.finite[a])
+      {
+        continue;
+      }
+      const double inv[2] = {bounds.inv_min[a],bounds.inv_max[a]};
+      const double lo[2] = {
+        box.min()(a) - bounds.origin_max[a],
+        box.min()(a) - bounds.origin_min[a]};
+      const double hi[2] = {
+        box.max()(a) - bounds.origin_max[a],
+        box.max()(a) - bounds.origin_min[a]};
+      double lo_min = std::numeric_limits<double>::infinity();
+      double hi_min = lo_min;
+      double lo_max = -lo_min;
+      double hi_max = -lo_min;
+      for(int i = 0;i<2;i++)
+      {
+        for(int j = 0;j<2;j++)
+        {
+          lo_min = std::min(lo_min,lo[i]*inv[j]);
+          lo_max = std::max(lo_max,lo[i]*inv[j]);
+          hi_min = std::min(hi_min,hi[i]*inv[j]);
+          hi_max = std::max(hi_max,hi[i]*inv[j]);
+        }
+      }
+      // Which slab is entered first depends on the direction's sign, unknown
+      // if the packet has both
+      double t_near = std::min(lo_min,hi_min);
+      double t_far = std::max(lo_max,hi_max);
+      if(inv[0] > 0)
+      {
+        t_near = lo_min;
+        t_far = hi_max;
+      }else if(inv[1] < 0)
+      {
+        t_near = hi_min;
+        t_far = lo_max;
+      }
+      // Padded like the exit of ray_box_intersect
+      t_far *= 1.0 + 4.0 * std::numeric_limits<double>::epsilon();
+      t0 = std::max(t0,t_near);
+      t1 = std::min(t1,t_far);
+    }
+    return t0 <= t1;
+  }
+}
+
+template <typename LeafFunc>
+inline bool BVH::closest_hit(
+  const Ray & ray,
+  const double min_t,
+  double & max_t,
+  LeafFunc && leaf) const
+{
+  return closest_hit_leaves(ray,min_t,max_t,
+    [&](const int begin, const int end, double & max_t) -> bool
+    {
+      bool hit = false;
+      for(int i = begin;i<end;i++)
+      {
+        if(leaf(indices[i],max_t))
+        {
+          hit = true;
+        }
+      }
+      return hit;
+    });
+}
+
+template <typename LeafFunc>
+inline bool BVH::closest_hit_leaves(
+  const Ray & ray,
+  const double min_t,
+  double & max_t,
+  LeafFunc && leaf) const
+{
+  if(nodes.empty())
+  {
+    return false;
+  }
+  if(!compressed.empty())
+  {
+    return wide_closest_hit_leaves(
+      bvh_detail::CompressedView{compressed.data()},ray,min_t,max_t,leaf);
+  }
+  if(wide.width > 2)
+  {
+    return wide_closest_hit_leaves(
+      bvh_detail::WideView{wide},ray,min_t,max_t,leaf);
+  }
+  std::uint64_t visits = 0;
+  std::uint64_t tests = 0;
+  const bool hit = subtree_closest_hit_leaves(
+    0,ray,ray.direction.cwiseInverse(),min_t,max_t,leaf,visits,tests);
+  count_traversal(1,visits,tests);
+  return hit;
+}
+
+template <typename LeafFunc>
+inline bool BVH::subtree_closest_hit_leaves(
+  const int root,
+  const Ray & ray,
+  const Eigen::Vector3d & inv_direction,
+  const double min_t,
+  double & max_t,
+  LeafFunc && leaf,
+  std::uint64_t & visits,
+  std::uint64_t & tests) const
+{
+  double t_enter;
+  visits++;
+  if(!ray_box_intersect(
+    nodes[root].box,ray.origin,inv_direction,min_t,max_t,t_enter))
+  {
+    return false;
+  }
+  // Each stack entry remembers the entry distance of its box so that nodes
+  // made irrelevant by a closer hit are dropped without a second box test
+  int stack[64];
+  double stack_t[64];
+  int top = 0;
+  stack[top] = root;
+  stack_t[top++] = t_enter;
+  bool hit = false;
+  while(top > 0)
+  {
+    top--;
+    if(stack_t[top] > max_t)
+    {
+      continue;
+    }
+    const Node * node = &nodes[stack[top]];
+    while(true)
+    {
+      if(node->count > 0)
+      {
+        tests += node->count;
+        if(leaf(node->offset,node->offset+node->count,max_t))
+        {
+          hit = true;
+        }
+        break;
+      }
+      const int first = static_cast<int>(node - nodes.data()) + 1;
+      const int second = node->offset;
+      double t_first, t_second;
+      const bool hit_first = ray_box_intersect(
+        nodes[first].box,ray.origin,inv_direction,min_t,max_t,t_first);
+      const bool hit_second = ray_box_intersect(
+        nodes[second].box,ray.origin,inv_direction,min_t,max_t,t_second);
+      visits += 2;
+      if(hit_first && hit_second)
+      {
+        // Descend into the nearer child, defer the farther one
+        if(t_second < t_first)
+        {
+          stack[top] = first;
+          stack_t[top++] = t_first;
+          node = &nodes[second];
+        }else
+        {
+          stack[top] = second;
+          stack_t[top++] = t_second;
+          node = &nodes[first];
+        }
+      }else if(hit_first)
+      {
+        node = &nodes[first];
+      }else if(hit_second)
+      {
+        node = &nodes[second];
+      }else
+      {
+        break;
+      }
+    }
+  }
+  return hit;
+}
+
+template <typename LeafFunc>
+inline bool BVH::closest_hit_packet_leaves(
+  const RayPacket & packet,
+  const double min_t,
+  double * max_t,
+  LeafFunc && leaf) const
+{
+  using bvh_detail::PacketEntry;
+  if(nodes.empty() || packet.size <= 0)
+  {
+    return false;
+  }
+  const double infinity = std::numeric_limits<double>::infinity();
+  Eigen::Vector3d inv_directions[RayPacket::MAX_SIZE];
+  bvh_detail::PacketBounds bounds;
+  for(int a = 0;a<3;a++)
+  {
+    bounds.origin_min[a] = bounds.inv_min[a] = infinity;
+    bounds.origin_max[a] = bounds.inv_max[a] = -infinity;
+    bounds.finite[a] = true;
+  }
+  for(int r = 0;r<packet.size;r++)
+  {
+    const Ray & ray = packet.rays[r];
+    inv_directions[r] = ray.direction.cwiseInverse();
+    for(int a = 0;a<3;a++)
+    {
+      const double inv = inv_directions[r](a);
+      bounds.origin_min[a] = std::min(bounds.origin_min[a],ray.origin(a));
+      bounds.origin_max[a] = std::max(bounds.origin_max[a],ray.origin(a));
+      bounds.inv_min[a] = std::min(bounds.inv_min[a],inv);
+      bounds.inv_max[a] = std::max(bounds.inv_max[a],inv);
+      bounds.finite[a] = bounds.finite[a] && std::isfinite(inv);
+    }
+  }
+  // Farthest hit any ray still accepts
+  double packet_max_t = *std::max_element(max_t,max_t+packet.size);
+  // The tree is at most 60 levels deep and every level leaves at most one
+  // child on the stack
+  PacketEntry stack[64];
+  int top = 0;
+  stack[top++] = PacketEntry{0,0,packet.size};
+  bool hit = false;
+  std::uint64_t visits = 0;
+  std::uint64_t tests = 0;
+  std::uint64_t packet_visits = 0;
+  std::uint64_t active = 0;
+  std::uint64_t fallbacks = 0;
+  while(top > 0)
+  {
+    const PacketEntry entry = stack[--top];
+    const Node & node = nodes[entry.node];
+    packet_visits++;
+    if(!bvh_detail::packet_may_hit(bounds,node.box,min_t,packet_max_t))
+    {
+      continue;
+    }
+    // Narrow the range to the first and the last ray that hit the box
+    double t_enter;
+    int first = entry.first;
+    while(first < entry.last && !ray_box_intersect(node.box,
+      packet.rays[first].origin,inv_directions[first],min_t,max_t[first],
+      t_enter))
+    {
+      first++;
+    }
+    if(first == entry.last)
+    {
+      continue;
+    }
+    int last = entry.last;
+    while(last-1 > first && !ray_box_intersect(node.box,
+      packet.rays[last-1].origin,inv_directions[last-1],min_t,max_t[last-1],
+      t_enter))
+    {
+      last--;
+    }
+    active += last - first;
+    if(last - first < bvh_detail::PACKET_MIN_RAYS)
+    {
+      // Too few rays left to share the work: finish the subtree ray by ray
+      for(int r = first;r<last;r++)
+      {
+        // The subtree search shrinks max_t[r] itself, the leaf sees it
+        // through the packet's array
+        if(subtree_closest_hit_leaves(
+          entry.node,packet.rays[r],inv_directions[r],min_t,max_t[r],
+          [&](const int begin, const int end, double &) -> bool
+          {
+            return leaf(begin,end,r,r+1,max_t);
+          },visits,tests))
+        {
+          hit = true;
+        }
+      }
+      fallbacks += last - first;
+      packet_max_t = *std::max_element(max_t,max_t+packet.size);
+      continue;
+    }
+    if(node.count > 0)
+    {
+      tests += (std::uint64_t)node.count*(last - first);
+      if(leaf(node.offset,node.offset+node.count,first,last,max_t))
+      {
+        hit = true;
+      }
+      packet_max_t = *std::max_element(max_t,max_t+packet.size);
+      continue;
+    }
+    // Visit first the child lying ahead along the first ray's direction on
+    // the axis separating the children's centers most
+    const int first_child = entry.node + 1;
+    const int second_child = node.offset;
+    const Eigen::Vector3d gap =
+      nodes[second_child].box.center() - nodes[first_child].box.center();
+    int axis;
+    gap.cwiseAbs().maxCoeff(&axis);
+    const bool second_nearer =
+      gap(axis) * packet.rays[first].direction(axis) < 0;
+    stack[top++] = PacketEntry{
+      second_nearer ? first_child : second_child,first,last};
+    stack[top++] = PacketEntry{
+      second_nearer ? second_child : first_child,first,last};
+  }
+  count_traversal(packet.size,visits + packet_visits,tests);
+  if(collect_stats())
+  {
+    traversal_stats.packets.fetch_add(1,std::memory_order_relaxed);
+    traversal_stats.packet_rays.fetch_add(
+      packet.size,std::memory_order_relaxed);
+    traversal_stats.packet_node_visits.fetch_add(
+      packet_visits,std::memory_order_relaxed);
+    traversal_stats.packet_slots.fetch_add(
+      packet_visits*packet.size,std::memory_order_relaxed);
+    traversal_stats.packet_active.fetch_add(
+      active,std::memory_order_relaxed);
+    traversal_stats.packet_fallbacks.fetch_add(
+      fallbacks,std::memory_order_relaxed);
+  }
+  return hit;
+}
+
+template <typename LeafFunc>
+inline bool BVH::any_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  LeafFunc && leaf) const
+{
+  return any_hit_leaves(ray,min_t,max_t,
+    [&](const int begin, const int end) -> bool
+    {
+      for(int i = begin;i<end;i++)
+      {
+        if(leaf(indices[i]))
+        {
+          return true;
+        }
+      }
+      return false;
+    });
+}
+
+template <typename LeafFunc>
+inline bool BVH::any_hit_leaves(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  LeafFunc && leaf) const
+{
+  if(nodes.empty())
+  {
+    return false;
+  }
+  if(!compressed.empty())
+  {
+    return wide_any_hit_leaves(
+      bvh_detail::CompressedView{compressed.data()},ray,min_t,max_t,leaf);
+  }
+  if(wide.width > 2)
+  {
+    return wide_any_hit_leaves(
+      bvh_detail::WideView{wide},ray,min_t,max_t,leaf);
+  }
+  const Eigen::Vector3d inv_direction = ray.direction.cwiseInverse();
+  int stack[64];
+  int top = 0;
+  stack[top++] = 0;
+  bool hit = false;
+  std::uint64_t visits = 0;
+  std::uint64_t tests = 0;
+  while(top > 0 && !hit)
+  {
+    const Node & node = nodes[stack[--top]];
+    visits++;
+    double t_enter;
+    if(!ray_box_intersect(
+      node.box,ray.origin,inv_direction,min_t,max_t,t_enter))
+    {
+      continue;
+    }
+    if(node.count > 0)
+    {
+      tests += node.count;
+      hit = leaf(node.offset,node.offset+node.count);
+    }else
+    {
+      stack[top++] = node.offset;
+      stack[top++] = static_cast<int>(&node - nodes.data()) + 1;
+    }
+  }
+  count_traversal(1,visits,tests);
+  return hit;
+}
+
+// Wide traversal. Every node visit tests all children of a wide node at
+// once; hit children are pushed farthest first, so the nearest is visited
+// next. The tree is at most 60 levels deep and every level leaves at most
+// width-1 children on the stack.
+template <typename WideView, typename LeafFunc>
+inline bool BVH::wide_closest_hit_leaves(
+  const WideView & view,
+  const Ray & ray,
+  const double min_t,
+  double & max_t,
+  LeafFunc && leaf) const
+{
+  using bvh_detail::WideEntry;
+  const Eigen::Vector3d inv_direction = ray.direction.cwiseInverse();
+  const SimdRay simd_ray{
+    {ray.origin(0),ray.origin(1),ray.origin(2)},
+    {inv_direction(0),inv_direction(1),inv_direction(2)}};
+  const SimdKernels & kernels = simd_kernels();
+  WideEntry stack[bvh_detail::WIDE_STACK_SIZE];
+  int top = 0;
+  stack[top++] = WideEntry{0,0,min_t};
+  bool hit = false;
+  std::uint64_t visits = 0;
+  std::uint64_t tests = 0;
+  while(top > 0)
+  {
+    const WideEntry entry = stack[--top];
+    if(entry.t > max_t)
+    {
+      continue;
+    }
+    if(entry.count > 0)
+    {
+      tests += entry.count;
+      if(leaf(entry.child,entry.child+entry.count,max_t))
+      {
+        hit = true;
+      }
+      continue;
+    }
+    visits++;
+    double t_enter[SIMD_MAX_LANES];
+    int mask = view.hits(kernels,simd_ray,min_t,max_t,entry.child,t_enter);
+    // Insert the hit children sorted by decreasing entry distance
+    const int base = top;
+    for(int slot = 0;mask;slot++,mask >>= 1)
+    {
+      if(!(mask & 1))
+      {
+        continue;
+      }
+      const WideEntry child{
+        view.child(entry.child,slot),
+        view.count(entry.child,slot),
+        t_enter[slot]};
+      int i = top++;
+      while(i > base && stack[i-1].t < child.t)
+      {
+        stack[i] = stack[i-1];
+        i--;
+      }
+      stack[i] = child;
+    }
+  }
+  count_traversal(1,visits,tests);
+  return hit;
+}
+
+template <typename WideView, typename LeafFunc>
+inline bool BVH::wide_any_hit_leaves(
+  const WideView & view,
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  LeafFunc && leaf) const
+{
+  using bvh_detail::WideEntry;
+  const Eigen::Vector3d inv_direction = ray.direction.cwiseInverse();
+  const SimdRay simd_ray{
+    {ray.origin(0),ray.origin(1),ray.origin(2)},
+    {inv_direction(0),inv_direction(1),inv_direction(2)}};
+  const SimdKernels & kernels = simd_kernels();
+  WideEntry stack[bvh_detail::WIDE_STACK_SIZE];
+  int top = 0;
+  stack[top++] = WideEntry{0,0,min_t};
+  bool hit = false;
+  std::uint64_t visits = 0;
+  std::uint64_t tests = 0;
+  while(top > 0 && !hit)
+  {
+    const WideEntry entry = stack[--top];
+    if(entry.count > 0)
+    {
+      tests += entry.count;
+      hit = leaf(entry.child,entry.child+entry.count);
+      continue;
+    }
+    visits++;
+    double t_enter[SIMD_MAX_LANES];
+    int mask = view.hits(kernels,simd_ray,min_t,max_t,entry.child,t_enter);
+    for(int slot = 0;mask;slot++,mask >>= 1)
+    {
+      if(mask & 1)
+      {
+        stack[top++] = WideEntry{
+          view.child(entry.child,slot),
+          view.count(entry.child,slot),
+          t_enter[slot]};
+      }
+    }
+  }
+  count_traversal(1,visits,tests);
+  return hit;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HIT_RECORD_H
+#define HIT_RECORD_H
+
+// What a closest-hit search needs to remember about a candidate hit. It is
+// enough to reconstruct the surface normal once the winner is known, but
+// cheap enough to copy around while candidates are still being compared.
+struct HitRecord
+{
+  // Parametric distance along the ray
+  double t;
+  // Index of the primitive hit within the object (e.g., triangle within a
+  // soup), or -1 for objects made of a single primitive
+  int primitive = -1;
+  // Surface parameters at the hit (barycentric coordinates for triangles)
+  double u = 0, v = 0;
+};
+
+#endif
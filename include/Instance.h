@@ -0,0 +1,82 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "Object.h"
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <memory>
+
+// A shared object (e.g., a mesh, or a TriangleSoup grouping a sub-scene)
+// placed in the scene by an affine transformation. Any number of instances
+// may refer to the same object, so repeated geometry is stored once. Rays
+// are carried into the object's space at the instance boundary, and
+// normals carried back.
+class Instance : public Object
+{
+  public:
+    // Holds fixed-size vectorizable Eigen members
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    // Object in its own (object) space; its material is ignored in favor
+    // of the instance's
+    std::shared_ptr<const Object> object;
+
+    Instance() {}
+    // Inputs:
+    //   object  object to place
+    //   transform  map from object space to scene space (must be invertible)
+    Instance(
+      const std::shared_ptr<const Object> & object,
+      const Eigen::Affine3d & transform);
+    // Map from object space to scene space
+    const Eigen::Affine3d & transform() const { return to_scene; }
+    // Change the placement.
+    //
+    // Inputs:
+    //   transform  map from object space to scene space (must be invertible)
+    void set_transform(const Eigen::Affine3d & transform);
+    // Intersect instance with ray.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    // Outputs:
+    //   t  first intersection at ray.origin + t * ray.direction
+    //   n  surface normal at point of intersection
+    // Returns iff there a first intersection is found.
+    bool intersect(
+      const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Intersect without evaluating the normal (see Object::hit)
+    bool hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      HitRecord & record) const;
+    // Intersect a range of rays of a packet (see Object::hit_packet)
+    void hit_packet(
+      const RayPacket & packet,
+      const int first,
+      const int last,
+      const double min_t,
+      double * max_t,
+      HitRecord * records) const;
+    // Unit normal at a hit found by hit (see Object::surface_normal)
+    Eigen::Vector3d surface_normal(
+      const Ray & ray, const double min_t, const HitRecord & record) const;
+    // Determine whether the instance blocks the ray within [min_t, max_t]
+    bool any_hit(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Box around the transformed box of the object
+    bool bounding_box(Eigen::AlignedBox3d & box) const;
+  private:
+    Eigen::Affine3d to_scene = Eigen::Affine3d::Identity();
+    Eigen::Affine3d to_object = Eigen::Affine3d::Identity();
+    // Inverse transpose of the linear part, which carries normals to scene
+    // space
+    Eigen::Matrix3d normal_to_scene = Eigen::Matrix3d::Identity();
+
+    // Same ray in object space. The direction is not renormalized, so
+    // parametric distances t are the same in both spaces.
+    Ray object_ray(const Ray & ray) const;
+};
+
+#endif
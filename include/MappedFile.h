@@ -0,0 +1,38 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. On POSIX systems the file is memory mapped,
+// so pages are only read from disk (or the page cache) when touched and no
+// copy is made; elsewhere it is read into memory in one go.
+class MappedFile
+{
+  public:
+    MappedFile() {}
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+    // Map a file, replacing any previously mapped one.
+    //
+    // Inputs:
+    //   filename  path to file
+    // Returns true on success, false on failure (e.g., can't open file)
+    bool open(const std::string & filename);
+    // Unmap the file
+    void close();
+    // First byte of the file (null if none is mapped or it is empty)
+    const char * data() const { return begin; }
+    // Size of the file in bytes
+    std::size_t size() const { return length; }
+  private:
+    const char * begin = nullptr;
+    std::size_t length = 0;
+    // Whether begin points into a mapping (as opposed to into buffer)
+    bool mapped = false;
+    std::vector<char> buffer;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "TriangleMesh.h"
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of meshes loaded from .stl files, keyed by the hash of
+// the file's contents (and the way the hierarchy is built): the same file
+// referenced by several soups, by several scenes, or under several paths is
+// loaded, welded and built once, and its immutable mesh is shared by
+// reference. Meshes not used for a while are
+// dropped once the cache grows beyond a memory budget (least recently used
+// first); soups still holding one keep it alive.
+//
+// Built meshes are also kept on disk next to their .stl files (see
+// mesh_bvh_file.h), so that a mesh is only welded and built once across
+// runs.
+class MeshCache
+{
+  public:
+    struct Stats
+    {
+      std::uint64_t hits = 0;
+      std::uint64_t misses = 0;
+      std::uint64_t evictions = 0;
+      // Misses served from .bvh files
+      std::uint64_t file_loads = 0;
+      // Meshes handed over by adopt (e.g., read back from a scene cache)
+      std::uint64_t adopted = 0;
+      // Meshes currently cached and the memory they hold
+      int meshes = 0;
+      std::size_t bytes = 0;
+    };
+
+    // Inputs:
+    //   budget  bytes of mesh memory to keep cached
+    explicit MeshCache(const std::size_t budget = DEFAULT_BUDGET):
+      budget(budget) {}
+    MeshCache(const MeshCache &) = delete;
+    MeshCache & operator=(const MeshCache &) = delete;
+    // Mesh (with hierarchy) of an .stl file, loading it on a miss. Safe to
+    // call from several threads at once; concurrent requests for the same
+    // contents wait for a single load.
+    //
+    // Inputs:
+    //   filename  path to .stl file
+    //   method  how to build the mesh's hierarchy
+    //   compress  whether to compress the hierarchy (see BVH::compress)
+    //   num_threads  number of threads to build the hierarchy with on a
+    //     miss (0 for hardware concurrency; callers loading several meshes at
+    //     once should share the cores out between them)
+    // Returns shared mesh (empty if the file can't be read)
+    std::shared_ptr<const TriangleMesh> load(
+      const std::string & filename,
+      const BVH::BuildMethod method = BVH::BINNED_SAH,
+      const bool compress = false,
+      const int num_threads = 0);
+    // Share a mesh loaded some other way (e.g., read back from a scene
+    // cache) under its cache_key, as if load had loaded it. Safe to call
+    // from several threads at once.
+    //
+    // Inputs:
+    //   mesh  built mesh with a nonzero cache_key
+    // Returns the cached mesh with the same key if there is one (counted as
+    //   a hit), otherwise mesh, which is cached from now on
+    std::shared_ptr<const TriangleMesh> adopt(
+      const std::shared_ptr<const TriangleMesh> & mesh);
+    // Change the memory budget, evicting meshes as needed
+    void set_budget(const std::size_t budget);
+    // Choose whether misses read and write .bvh files (on by default)
+    void set_use_files(const bool use_files);
+    // Drop every cached mesh
+    void clear();
+    Stats stats() const;
+    // Print memory use and hit statistics
+    void print_stats(std::ostream & os) const;
+
+    static const std::size_t DEFAULT_BUDGET = std::size_t(1) << 30;
+  private:
+    struct Entry
+    {
+      std::shared_future<std::shared_ptr<const TriangleMesh> > mesh;
+      // 0 while the mesh is loading
+      std::size_t bytes;
+      // Position in lru
+      std::list<std::uint64_t>::iterator use;
+    };
+    mutable std::mutex mutex;
+    std::size_t budget;
+    bool use_files = true;
+    // Keyed by content hash (mixed with the build method and compression)
+    std::unordered_map<std::uint64_t,Entry> entries;
+    // Most recently used first
+    std::list<std::uint64_t> lru;
+    Stats counters;
+
+    // Drop least recently used, fully loaded meshes until within budget.
+    // Call with mutex held.
+    void evict();
+};
+
+// Cache shared by the whole process
+MeshCache & mesh_cache();
+
+#endif
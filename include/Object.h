@@ -2,7 +2,10 @@
 #define OBJECT_H
 
 #include "Material.h"
+#include "HitRecord.h"
+#include "RayPacket.h"
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <memory>
 
 struct Ray;
@@ -25,6 +28,107 @@ class Object
     // The funny = 0 just ensures that this function is defined (as a no-op)
     virtual bool intersect(
         const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const = 0;
+    // Intersect object with ray without evaluating the surface normal. Used by
+    // closest-hit searches, which call surface_normal only for the winner.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  only hits strictly closer than this are reported
+    // Outputs:
+    //   record  first intersection with t in [min_t, max_t)
+    // Returns iff there a first intersection is found.
+    //
+    // The default falls back to intersect.
+    virtual bool hit(
+        const Ray & ray,
+        const double min_t,
+        const double max_t,
+        HitRecord & record) const
+    {
+      double t;
+      Eigen::Vector3d n;
+      if(intersect(ray, min_t, t, n) && t < max_t)
+      {
+        record.t = t;
+        record.primitive = -1;
+        return true;
+      }
+      return false;
+    }
+    // Same as hit, for a range of rays of a packet traced together (see
+    // BVH::closest_hit_packet_leaves).
+    //
+    // Inputs:
+    //   packet  rays to intersect with (only rays [first,last) are read)
+    //   first  first ray of the range
+    //   last  one past last ray of the range
+    //   min_t  minimum parametric distance to consider
+    //   max_t  packet.size maximum parametric distances, one per ray
+    // Outputs:
+    //   max_t  shrunk to the hit of every ray in the range with a hit closer
+    //     than its max_t (unchanged for the others)
+    //   records  packet.size records, set for the rays whose max_t shrank
+    //
+    // The default calls hit for one ray after the other.
+    virtual void hit_packet(
+        const RayPacket & packet,
+        const int first,
+        const int last,
+        const double min_t,
+        double * max_t,
+        HitRecord * records) const
+    {
+      for(int r = first;r<last;r++)
+      {
+        if(hit(packet.rays[r], min_t, max_t[r], records[r]))
+        {
+          max_t[r] = records[r].t;
+        }
+      }
+    }
+    // Surface normal at a hit previously found by `hit`.
+    //
+    // Inputs:
+    //   Ray  ray passed to hit
+    //   min_t  min_t passed to hit
+    //   record  record filled by hit
+    // Returns unit surface normal at the hit.
+    //
+    // The default repeats intersect.
+    virtual Eigen::Vector3d surface_normal(
+        const Ray & ray, const double min_t, const HitRecord &) const
+    {
+      double t;
+      Eigen::Vector3d n;
+      intersect(ray, min_t, t, n);
+      return n;
+    }
+    // Determine whether the object blocks a ray segment, e.g. a shadow ray on
+    // its way to a light. Unlike intersect, this may stop at any hit and
+    // never computes a normal.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider
+    // Returns true iff there is an intersection with t in [min_t, max_t].
+    //
+    // The default falls back to intersect.
+    virtual bool any_hit(
+        const Ray & ray, const double min_t, const double max_t) const
+    {
+      double t;
+      Eigen::Vector3d n;
+      return intersect(ray, min_t, t, n) && t <= max_t;
+    }
+    // Axis-aligned bounding box of the object.
+    //
+    // Outputs:
+    //   box  box containing the whole object
+    // Returns true iff the object is bounded (the default, false, is for
+    // infinite shapes such as planes)
+    virtual bool bounding_box(Eigen::AlignedBox3d &) const { return false; }
 };
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef PLANE_BATCH_H
+#define PLANE_BATCH_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <vector>
+
+// Planes stored as a structure of arrays so that one ray can be tested
+// against several planes at once with SIMD instructions (see
+// simd_kernels.h). The arithmetic mirrors Plane::hit operation for
+// operation.
+class PlaneBatch
+{
+  public:
+    // Normal and point coordinates nx,ny,nz,px,py,pz, one entry per slot
+    // plus padding so that a full vector load starting at any slot stays in
+    // bounds
+    std::vector<double> planes[6];
+
+    // Number of slots
+    int size() const { return num_slots; }
+    // Remove all slots
+    void clear();
+    // Append a plane through point with the given normal
+    void push_back(const Eigen::Vector3d & point, const Eigen::Vector3d & normal);
+    // Replace the plane in an existing slot
+    void set(
+      const int slot,
+      const Eigen::Vector3d & point,
+      const Eigen::Vector3d & normal);
+    // Find the closest plane hit among a range of slots.
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  only hits strictly beyond this are reported
+    //   begin,end  range of slots to test
+    //   max_t  only hits strictly closer than this are reported
+    // Outputs:
+    //   max_t  parametric distance of closest hit (unchanged if none)
+    // Returns slot of the closest hit (lowest slot among ties), or -1 if none
+    int closest_hit(
+      const Ray & ray,
+      const double min_t,
+      const int begin,
+      const int end,
+      double & max_t) const;
+    // Determine whether any plane in a range of slots blocks the ray.
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  only hits strictly beyond this are considered
+    //   max_t  maximum parametric distance to consider
+    //   begin,end  range of slots to test
+    // Returns true iff some plane is hit with t in (min_t, max_t]
+    bool any_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      const int begin,
+      const int end) const;
+  private:
+    int num_slots = 0;
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "Ray.h"
+#include "simd_kernels.h"
+
+// Rays traced together through a hierarchy (see
+// BVH::closest_hit_packet_leaves), e.g. the viewing rays of a block of
+// neighbouring pixels. Traversal works on ranges of rays, so rays close in
+// the image should also be close in the packet.
+struct RayPacket
+{
+  static const int MAX_SIZE = SIMD_PACKET_SIZE;
+  // Number of rays
+  int size = 0;
+  Ray rays[MAX_SIZE];
+};
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "Object.h"
+#include "BVH.h"
+#include "PlaneBatch.h"
+#include "SphereBatch.h"
+#include "TriangleBatch.h"
+#include <memory>
+#include <vector>
+
+// Scene geometry compiled for fast ray queries. Bounded objects (spheres,
+// triangles, soups, ...) are organized in a BVH, unbounded ones (planes) are
+// kept in a short list that is tested linearly. Objects of the built-in
+// types are copied into per-type arrays and intersected without virtual
+// calls; any other Object is still supported through its virtual interface.
+//
+// This is the top level of a two-level hierarchy: soups and instances carry
+// their own bottom-level BVHs, so when objects move (e.g., an Instance gets a
+// new transform) only the scene BVH needs to follow (see update).
+class Scene
+{
+  public:
+    // Cost of one call to update
+    struct UpdateStats
+    {
+      // Number of objects reported as changed
+      int changed = 0;
+      // Whether the hierarchy was rebuilt (true) or only refit (false)
+      bool rebuilt = false;
+      // SAH cost of the hierarchy after the update, and right after its last
+      // full build
+      double sah_cost = 0;
+      double built_sah_cost = 0;
+      double update_ms = 0;
+    };
+
+    // List of objects (shapes) in the scene
+    std::vector<std::shared_ptr<Object> > objects;
+    // Hierarchy over bounded objects. Its primitive indices refer to
+    // `bounded`, not to `objects` directly.
+    BVH bvh;
+    // Indices into objects of bounded objects
+    std::vector<int> bounded;
+    // Indices into objects of unbounded objects other than plain Planes
+    std::vector<int> unbounded;
+    // Plain Planes, tested as one SIMD batch, and the index into objects of
+    // the plane in each slot
+    PlaneBatch planes;
+    std::vector<int> plane_objects;
+    // Index into objects of the object in each BVH slot (position in
+    // bvh.indices, so that every leaf is a contiguous range of slots)
+    std::vector<int> slot_objects;
+    // The slots of every leaf are sorted by type: plain Spheres, then plain
+    // Triangles, then everything else (tested through the Object interface).
+    // Indexed by the first slot of a leaf:
+    //   sphere_end  end of the leaf's spheres
+    //   triangle_end  end of the leaf's triangles
+    std::vector<int> sphere_end;
+    std::vector<int> triangle_end;
+    // Plain spheres and triangles in BVH slot order, intersected without
+    // virtual calls, several at a time. Each batch holds only its own type,
+    // so the spheres of a leaf starting at slot begin are the entries from
+    // sphere_offset[begin] on (likewise for triangles). Indexed by slot:
+    //   sphere_offset  number of plain spheres in earlier slots
+    //   triangle_offset  number of plain triangles in earlier slots
+    SphereBatch spheres;
+    TriangleBatch triangles;
+    std::vector<int> sphere_offset;
+    std::vector<int> triangle_offset;
+
+    Scene() {}
+    // Inputs:
+    //   objects  list of objects in the scene
+    explicit Scene(const std::vector<std::shared_ptr<Object> > & objects);
+    // (Re)build the acceleration structure. Call once after filling (or
+    // changing) objects.
+    void build();
+    // Same as build, but reuse a hierarchy built earlier over the same
+    // objects (e.g., read back from a cache).
+    //
+    // Inputs:
+    //   prebuilt  bvh of a Scene built from identical objects
+    // Returns true iff prebuilt was used (if it does not fit the objects the
+    //   hierarchy is built from scratch instead)
+    bool build(const BVH & prebuilt);
+    // Bring the scene up to date after some objects changed in place (moved,
+    // resized, re-placed, or replaced by another object in objects). The
+    // hierarchy is refit to the new boxes, and only rebuilt once refitting
+    // has degraded it too far (or objects changed kind, e.g. from bounded to
+    // unbounded). Bottom-level hierarchies are never touched: a soup whose
+    // triangles were edited must be rebuilt by its owner first.
+    //
+    // Inputs:
+    //   changed  indices into objects of the objects that changed
+    // Returns cost of the update
+    UpdateStats update(const std::vector<int> & changed);
+  private:
+    // Bounding box of every bounded object (indexed like `bounded`)
+    std::vector<Eigen::AlignedBox3d> boxes;
+    // Where every object is compiled to: its BVH slot if bounded, its slot in
+    // planes if a plain Plane, -1 otherwise
+    std::vector<int> object_slots;
+    // Kind of every object as compiled (see Scene.cpp)
+    std::vector<int> object_kinds;
+
+    // Split objects into bounded, unbounded and plane lists and compute the
+    // boxes of the bounded ones
+    void classify();
+    // Fill the per-slot data from bvh
+    void compile();
+};
+
+#endif
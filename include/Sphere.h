@@ -22,6 +22,20 @@ class Sphere : public Object
     // Returns iff there a first intersection is found.
     bool intersect(
       const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Intersect without evaluating the normal (see Object::hit)
+    bool hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      HitRecord & record) const;
+    // Unit normal at a hit found by hit (see Object::surface_normal)
+    Eigen::Vector3d surface_normal(
+      const Ray & ray, const double min_t, const HitRecord & record) const;
+    // Determine whether the sphere blocks the ray within [min_t, max_t]
+    bool any_hit(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Box from center - radius to center + radius
+    bool bounding_box(Eigen::AlignedBox3d & box) const;
 };
 
 #endif
@@ -0,0 +1,64 @@
+#ifndef SPHERE_BATCH_H
+#define SPHERE_BATCH_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <vector>
+
+// Spheres stored as a structure of arrays so that one ray can be tested
+// against several spheres at once with SIMD instructions (2, 4 or 8 per
+// instruction depending on the kernels picked at run time, see
+// simd_kernels.h). The arithmetic mirrors Sphere::intersect operation for
+// operation, so batched and one-at-a-time tests report identical t.
+class SphereBatch
+{
+  public:
+    // Centers and radii, one entry per slot plus padding so that a full
+    // vector load starting at any slot stays in bounds
+    std::vector<double> cx, cy, cz, r;
+
+    // Number of slots
+    int size() const { return num_slots; }
+    // Remove all slots
+    void clear();
+    // Append a sphere
+    void push_back(const Eigen::Vector3d & center, const double radius);
+    // Replace the sphere in an existing slot
+    void set(const int slot, const Eigen::Vector3d & center, const double radius);
+    // Find the closest sphere hit among a range of slots.
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   begin,end  range of slots to test
+    //   max_t  only hits strictly closer than this are reported
+    // Outputs:
+    //   max_t  parametric distance of closest hit (unchanged if none)
+    // Returns slot of the closest hit (lowest slot among ties), or -1 if none
+    int closest_hit(
+      const Ray & ray,
+      const double min_t,
+      const int begin,
+      const int end,
+      double & max_t) const;
+    // Determine whether any sphere in a range of slots blocks the ray.
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider
+    //   begin,end  range of slots to test
+    // Returns true iff some sphere is hit with t in [min_t, max_t]
+    bool any_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      const int begin,
+      const int end) const;
+  private:
+    int num_slots = 0;
+    // Grow the padding after the last slot
+    void pad();
+};
+
+#endif
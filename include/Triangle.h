@@ -3,6 +3,8 @@
 
 #include "Object.h"
 #include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <tuple>
 
 class Triangle : public Object
 {
@@ -20,6 +22,35 @@ class Triangle : public Object
     // Returns iff there a first intersection is found.
     bool intersect(
       const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Intersect without evaluating the normal (see Object::hit)
+    bool hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      HitRecord & record) const;
+    // Unit normal at a hit found by hit (see Object::surface_normal)
+    Eigen::Vector3d surface_normal(
+      const Ray & ray, const double min_t, const HitRecord & record) const;
+    // Determine whether the triangle blocks the ray within [min_t, max_t]
+    bool any_hit(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Box around the three corners
+    bool bounding_box(Eigen::AlignedBox3d & box) const;
 };
 
+// Unit normal of the plane through three corners, oriented by their order
+//
+// Inputs:
+//   a,b,c  corners of the triangle
+// Returns unit normal (b-a)x(c-b) / |(b-a)x(c-b)|
+inline Eigen::Vector3d face_normal(
+  const Eigen::Vector3d & a,
+  const Eigen::Vector3d & b,
+  const Eigen::Vector3d & c)
+{
+  const Eigen::Vector3d ab = a - b;
+  const Eigen::Vector3d bc = b - c;
+  return ab.cross(bc) / (ab.cross(bc)).norm();
+}
+
 #endif
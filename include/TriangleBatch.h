@@ -0,0 +1,72 @@
+#ifndef TRIANGLE_BATCH_H
+#define TRIANGLE_BATCH_H
+
+#include "intersect_triangle.h"
+#include <Eigen/Core>
+#include <vector>
+
+// Triangles stored as a structure of arrays so that one ray can be tested
+// against several triangles at once with SIMD instructions (see
+// simd_kernels.h). The arithmetic mirrors intersect_triangle operation for
+// operation, so batched and one-at-a-time tests report identical hits.
+class TriangleBatch
+{
+  public:
+    // Corner coordinates ax,ay,az,bx,by,bz,cx,cy,cz, one entry per slot plus
+    // padding so that a full vector load starting at any slot stays in bounds
+    std::vector<double> corners[9];
+
+    // Number of slots
+    int size() const { return num_slots; }
+    // Remove all slots
+    void clear();
+    // Append a triangle with corners a,b,c
+    void push_back(
+      const Eigen::Vector3d & a,
+      const Eigen::Vector3d & b,
+      const Eigen::Vector3d & c);
+    // Replace the triangle in an existing slot with corners a,b,c
+    void set(
+      const int slot,
+      const Eigen::Vector3d & a,
+      const Eigen::Vector3d & b,
+      const Eigen::Vector3d & c);
+    // Find the closest triangle hit among a range of slots.
+    //
+    // Inputs:
+    //   ray  ray prepared for triangle tests
+    //   min_t  minimum parametric distance to consider
+    //   begin,end  range of slots to test
+    //   max_t  only hits strictly closer than this are reported
+    // Outputs:
+    //   max_t  parametric distance of closest hit (unchanged if none)
+    //   u,v  barycentric coordinates of the closest hit (see
+    //     intersect_triangle)
+    // Returns slot of the closest hit (lowest slot among ties), or -1 if none
+    int closest_hit(
+      const TriangleRay & ray,
+      const double min_t,
+      const int begin,
+      const int end,
+      double & max_t,
+      double & u,
+      double & v) const;
+    // Determine whether any triangle in a range of slots blocks the ray.
+    //
+    // Inputs:
+    //   ray  ray prepared for triangle tests
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider
+    //   begin,end  range of slots to test
+    // Returns true iff some triangle is hit with t in [min_t, max_t]
+    bool any_hit(
+      const TriangleRay & ray,
+      const double min_t,
+      const double max_t,
+      const int begin,
+      const int end) const;
+  private:
+    int num_slots = 0;
+};
+
+#endif
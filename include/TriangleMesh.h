@@ -0,0 +1,51 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "BVH.h"
+#include <Eigen/Core>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Indexed triangle mesh together with its hierarchy. A mesh is not changed
+// after build(), so one copy can be shared (through
+// std::shared_ptr<const TriangleMesh>) by every soup showing it and read by
+// any number of threads.
+struct TriangleMesh
+{
+  // Shared vertex positions and one triple of indices into vertices per
+  // triangle (triangle f has corners faces[3*f], faces[3*f+1],
+  // faces[3*f+2])
+  std::vector<Eigen::Vector3d> vertices;
+  std::vector<std::uint32_t> faces;
+  // Hierarchy over the triangles (empty until build() is called). Faces
+  // are stored in BVH slot order, so every leaf is a contiguous range of
+  // faces intersected straight from the shared vertices.
+  BVH bvh;
+  // Number of distinct triangles, counted by build() before spatial splits
+  // repeat some of them in faces
+  int num_triangles = 0;
+  // Key of the mesh in MeshCache (hash of the .stl contents and of how the
+  // hierarchy was built), 0 for meshes that did not come from an .stl file
+  std::uint64_t cache_key = 0;
+
+  // Build the hierarchy and reorder faces to match it (repeating faces the
+  // hierarchy splits, see BVH::SPATIAL_SAH). Call once after filling
+  // vertices and faces.
+  //
+  // Inputs:
+  //   method  how to build the hierarchy (see BVH::build)
+  //   num_threads  number of threads to build with (0 for hardware
+  //     concurrency)
+  void build(
+    const BVH::BuildMethod method = BVH::BINNED_SAH,
+    const int num_threads = 0);
+  // Number of triangles (each counted once, however many slots it takes)
+  int size() const { return num_triangles; }
+  // Number of triples in faces: one per BVH slot once built
+  int num_slots() const { return faces.size()/3; }
+  // Bytes of memory held by the mesh and its hierarchy
+  std::size_t memory_size() const;
+};
+
+#endif
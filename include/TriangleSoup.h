@@ -2,6 +2,8 @@
 #define TRIANGLE_SOUP_H
 
 #include "Object.h"
+#include "BVH.h"
+#include "TriangleMesh.h"
 #include <Eigen/Core>
 #include <memory>
 #include <vector>
@@ -11,9 +13,31 @@ class Triangle;
 class TriangleSoup : public Object
 {
   public:
-    // A soup is just a set (list) of triangles
+    // A soup is just a set (list) of triangles, given either as objects
     std::vector<std::shared_ptr<Object> > triangles;
+    // or, for large meshes, as a built indexed mesh with triangles left
+    // empty. Meshes are immutable, so several soups (e.g., the same .stl file
+    // used twice) may share one. build() welds Triangle objects into a mesh
+    // of their own.
+    std::shared_ptr<const TriangleMesh> mesh;
+    // Hierarchy over triangles when they are not all Triangle objects
+    // (empty until build() is called)
+    BVH bvh;
+    // How build() builds the hierarchy (and how a mesh for this soup should
+    // be built, see MeshCache::load)
+    BVH::BuildMethod build_method = BVH::BINNED_SAH;
+    // Whether build() compresses the hierarchy (and whether a mesh for this
+    // soup should be compressed, see BVH::compress)
+    bool compress_bvh = false;
 
+    // Build the acceleration structure over the current triangles. Call once
+    // after filling (or changing) them; until then intersect falls back to
+    // testing every triangle. Not needed for a soup given a mesh.
+    void build();
+    // Hierarchy used for ray queries (the mesh's, if there is one)
+    const BVH & hierarchy() const { return mesh ? mesh->bvh : bvh; }
+    // Number of triangles
+    int size() const;
     // Intersect a triangle soup with ray.
     //
     // Inputs:
@@ -25,6 +49,30 @@ class TriangleSoup : public Object
     // Returns iff there a first intersection is found.
     bool intersect(
       const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Intersect without evaluating the normal (see Object::hit)
+    bool hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      HitRecord & record) const;
+    // Intersect a range of rays of a packet (see Object::hit_packet). The
+    // rays walk the mesh hierarchy together, and leaves test several rays
+    // at once.
+    void hit_packet(
+      const RayPacket & packet,
+      const int first,
+      const int last,
+      const double min_t,
+      double * max_t,
+      HitRecord * records) const;
+    // Unit normal at a hit found by hit (see Object::surface_normal)
+    Eigen::Vector3d surface_normal(
+      const Ray & ray, const double min_t, const HitRecord & record) const;
+    // Determine whether the soup blocks the ray within [min_t, max_t]
+    bool any_hit(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Box around all triangles
+    bool bounding_box(Eigen::AlignedBox3d & box) const;
 };
 
 #endif
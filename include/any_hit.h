@@ -0,0 +1,23 @@
+#ifndef ANY_HIT_H
+#define ANY_HIT_H
+
+#include "Ray.h"
+#include "Scene.h"
+
+// Determine whether anything in the scene blocks a ray segment, e.g. a shadow
+// ray on its way to a light. Stops at the first blocker found and computes no
+// normals, so it is much cheaper than first_hit.
+//
+// Inputs:
+//   ray  ray along which to search
+//   min_t  minimum t value to consider
+//   max_t  maximum t value to consider (e.g., the distance to a light)
+//   scene  scene with built acceleration structure
+// Returns true iff some object is hit with t in [min_t, max_t]
+bool any_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  const Scene & scene);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Helpers for the binary caches (scene cache, BVH files). Values are stored
+// with their in-memory layout and byte order: the files are only meant to be
+// read back on the machine (and build) that wrote them, which every format
+// checks with a version and layout field.
+
+// Append the bytes of a plain value
+template <typename T>
+inline void write_binary(std::string & buffer, const T & value)
+{
+  buffer.append(reinterpret_cast<const char *>(&value),sizeof(T));
+}
+
+// Append a 64-bit element count followed by the elements
+template <typename T>
+inline void write_binary(std::string & buffer, const std::vector<T> & values)
+{
+  write_binary(buffer,(std::uint64_t)values.size());
+  buffer.append(
+    reinterpret_cast<const char *>(values.data()),values.size()*sizeof(T));
+}
+
+inline void write_binary(std::string & buffer, const std::string & value)
+{
+  write_binary(buffer,(std::uint64_t)value.size());
+  buffer.append(value);
+}
+
+// Sequential reader over a block of bytes (e.g., a MappedFile). Reads that
+// would run past the end fail and leave the reader at the end.
+struct BinaryReader
+{
+  const char * p;
+  const char * end;
+
+  bool read_bytes(void * destination, const std::size_t size)
+  {
+    if((std::size_t)(end - p) < size)
+    {
+      p = end;
+      return false;
+    }
+    std::memcpy(destination,p,size);
+    p += size;
+    return true;
+  }
+  template <typename T>
+  bool read(T & value)
+  {
+    return read_bytes(&value,sizeof(T));
+  }
+  template <typename T>
+  bool read(std::vector<T> & values)
+  {
+    std::uint64_t size;
+    if(!read(size) || size > (std::uint64_t)(end - p)/sizeof(T))
+    {
+      p = end;
+      return false;
+    }
+    values.resize(size);
+    return read_bytes(values.data(),size*sizeof(T));
+  }
+  bool read(std::string & value)
+  {
+    std::uint64_t size;
+    if(!read(size) || size > (std::uint64_t)(end - p))
+    {
+      p = end;
+      return false;
+    }
+    value.assign(p,size);
+    p += size;
+    return true;
+  }
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "Ray.h"
 #include "Light.h"
 #include "Object.h"
+#include "Scene.h"
 #include <Eigen/Core>
 #include <vector>
 #include <memory>
@@ -14,10 +15,10 @@
 // 
 // Inputs:
 //   ray  incoming ray
-//   hit_id  index into objects of the object just hit by ray
+//   hit_id  index into scene.objects of the object just hit by ray
 //   t  _parametric_ distance along ray to hit
 //   n  unit surface normal at hit
-//   objects  list of objects in the scene
+//   scene  objects in the scene and their acceleration structure
 //   lights  list of lights in the scene
 // Returns shaded color collected by this ray as rgb 3-vector
 Eigen::Vector3d blinn_phong_shading(
@@ -25,7 +26,7 @@ Eigen::Vector3d blinn_phong_shading(
   const int & hit_id, 
   const double & t,
   const Eigen::Vector3d & n,
-  const std::vector< std::shared_ptr<Object> > & objects,
+  const Scene & scene,
   const std::vector<std::shared_ptr<Light> > & lights);
 
 #endif
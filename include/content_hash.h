@@ -0,0 +1,30 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// 64-bit hash of a block of bytes, for recognizing unchanged inputs (not
+// cryptographic). Processes 8 bytes per step, so hashing runs at memory
+// speed.
+//
+// Inputs:
+//   data  first byte
+//   size  number of bytes
+//   seed  starting value, to chain several blocks
+// Returns hash of the bytes
+std::uint64_t content_hash(
+  const void * data,
+  const std::size_t size,
+  const std::uint64_t seed = 0);
+// Hash of a file's contents (see content_hash)
+//
+// Inputs:
+//   filename  path to file
+// Outputs:
+//   hash  hash of the file's bytes
+// Returns true on success, false on failure (e.g., can't open file)
+bool file_content_hash(const std::string & filename, std::uint64_t & hash);
+
+#endif
@@ -2,7 +2,9 @@
 #define FIRST_HIT_H
 
 #include "Ray.h"
+#include "RayPacket.h"
 #include "Object.h"
+#include "Scene.h"
 #include <Eigen/Core>
 #include <vector>
 #include <memory>
@@ -27,5 +29,44 @@ bool first_hit(
   int & hit_id, 
   double & t,
   Eigen::Vector3d & n);
+// Same as above, but search a scene through its acceleration structure.
+//
+// Inputs:
+//   ray  ray along which to search
+//   min_t  minimum t value to consider
+//   scene  scene with built acceleration structure
+// Outputs:
+//   hit_id  index into scene.objects of object with first hit
+//   t  _parametric_ distance along ray so that ray.origin+t*ray.direction is
+//     the hit location
+//   n  surface normal at hit location
+// Returns true iff a hit was found
+bool first_hit(
+  const Ray & ray, 
+  const double min_t,
+  const Scene & scene,
+  int & hit_id, 
+  double & t,
+  Eigen::Vector3d & n);
+// Same as above, for a packet of rays traced together through the scene's
+// hierarchy (see BVH::closest_hit_packet_leaves), e.g. the viewing rays of a
+// block of pixels.
+//
+// Inputs:
+//   packet  rays along which to search
+//   min_t  minimum t value to consider
+//   scene  scene with built acceleration structure
+// Outputs:
+//   hit_id  packet.size indices into scene.objects of object with first hit
+//     along each ray (-1 if none)
+//   t  packet.size _parametric_ distances of the hits
+//   n  packet.size surface normals at the hits
+void first_hit(
+  const RayPacket & packet,
+  const double min_t,
+  const Scene & scene,
+  int * hit_id,
+  double * t,
+  Eigen::Vector3d * n);
 
 #endif
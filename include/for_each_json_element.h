@@ -0,0 +1,209 @@
+#ifndef FOR_EACH_JSON_ELEMENT_H
+#define FOR_EACH_JSON_ELEMENT_H
+
+#include <json.hpp>
+#include <functional>
+#include <string>
+
+// Stream a JSON document of the form {"key": value, ...} through json.hpp's
+// SAX interface. Each element of a top-level array is handed to the callback
+// on its own, as soon as its closing bracket is read, and dropped right
+// after, so a document with millions of elements never holds more than one
+// of them as a DOM. Top-level values that are not arrays are handed over
+// whole.
+//
+// Inputs:
+//   begin  first character of document
+//   end  one past last character of document
+//   callback  `void callback(const std::string & key, nlohmann::json & value)`
+//     called with the top-level key and one element (or value) at a time, in
+//     document order
+// Outputs:
+//   error  description of syntax error (if any)
+// Returns true on success, false if the document is not valid JSON or not an
+//   object
+inline bool for_each_json_element(
+  const char * begin,
+  const char * end,
+  const std::function<
+    void(const std::string & key, nlohmann::json & value)> & callback,
+  std::string & error);
+
+// Implementation
+
+#include <vector>
+
+namespace for_each_json_element_detail
+{
+  class ElementSax : public nlohmann::json_sax<nlohmann::json>
+  {
+    public:
+      using json = nlohmann::json;
+
+      const std::function<
+        void(const std::string & key, json & value)> & callback;
+      std::string error;
+
+      ElementSax(
+        const std::function<
+          void(const std::string & key, json & value)> & callback):
+        callback(callback) {}
+
+      bool null() override { return value(json()); }
+      bool boolean(bool val) override { return value(json(val)); }
+      bool number_integer(number_integer_t val) override
+      {
+        return value(json(val));
+      }
+      bool number_unsigned(number_unsigned_t val) override
+      {
+        return value(json(val));
+      }
+      bool number_float(number_float_t val, const string_t &) override
+      {
+        return value(json(val));
+      }
+      bool string(string_t & val) override { return value(json(val)); }
+      bool start_object(std::size_t) override
+      {
+        if(building.empty() && level == ROOT)
+        {
+          level = TOP_OBJECT;
+          return true;
+        }
+        return start(json::object());
+      }
+      bool key(string_t & val) override
+      {
+        if(building.empty())
+        {
+          top_key = val;
+        }else
+        {
+          element_key = val;
+        }
+        return true;
+      }
+      bool end_object() override
+      {
+        if(building.empty())
+        {
+          level = ROOT;
+          return true;
+        }
+        return finish();
+      }
+      bool start_array(std::size_t) override
+      {
+        if(building.empty() && level == TOP_OBJECT)
+        {
+          level = TOP_ARRAY;
+          return true;
+        }
+        return start(json::array());
+      }
+      bool end_array() override
+      {
+        if(building.empty())
+        {
+          level = TOP_OBJECT;
+          return true;
+        }
+        return finish();
+      }
+      bool parse_error(
+        std::size_t,
+        const std::string &,
+        const nlohmann::detail::exception & ex) override
+      {
+        error = ex.what();
+        return false;
+      }
+    private:
+      // Where the parser is outside of the element under construction
+      enum Level
+      {
+        ROOT,
+        TOP_OBJECT,
+        TOP_ARRAY
+      };
+      Level level = ROOT;
+      std::string top_key;
+      // Element under construction, its open containers and the key of the
+      // next member of the innermost open object
+      json element;
+      std::vector<json *> building;
+      std::string element_key;
+
+      // Place a value in the element under construction (or make it the
+      // element) and return where it ended up
+      json * add(json && val)
+      {
+        if(building.empty())
+        {
+          element = std::move(val);
+          return &element;
+        }
+        json & parent = *building.back();
+        if(parent.is_array())
+        {
+          parent.push_back(std::move(val));
+          return &parent.back();
+        }
+        json & member = parent[element_key];
+        member = std::move(val);
+        return &member;
+      }
+      bool value(json && val)
+      {
+        if(building.empty())
+        {
+          if(level == ROOT)
+          {
+            error = "document is not an object";
+            return false;
+          }
+          callback(top_key,val);
+        }else
+        {
+          add(std::move(val));
+        }
+        return true;
+      }
+      bool start(json && container)
+      {
+        if(building.empty() && level == ROOT)
+        {
+          error = "document is not an object";
+          return false;
+        }
+        building.push_back(add(std::move(container)));
+        return true;
+      }
+      bool finish()
+      {
+        building.pop_back();
+        if(building.empty())
+        {
+          callback(top_key,element);
+          element = json();
+        }
+        return true;
+      }
+  };
+}
+
+inline bool for_each_json_element(
+  const char * begin,
+  const char * end,
+  const std::function<
+    void(const std::string & key, nlohmann::json & value)> & callback,
+  std::string & error)
+{
+  for_each_json_element_detail::ElementSax sax(callback);
+  const bool success = nlohmann::json::sax_parse(begin,end,&sax);
+  error = sax.error;
+  return success && error.empty();
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef INTERSECT_TRIANGLE_H
+#define INTERSECT_TRIANGLE_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <cmath>
+#include <utility>
+
+// Ray prepared for watertight ray/triangle intersection (Woop, Benthin and
+// Wald, "Watertight Ray/Triangle Intersection", JCGT 2013). The ray is
+// sheared and permuted so that it points along +z. Applying the same
+// transformation to the corners turns each inside test into the sign of a 2D
+// edge function, which is computed bit-for-bit identically (up to sign) by
+// both triangles sharing that edge. Meshes therefore have no cracks for rays
+// to slip through. Set up once per ray, then test any number of triangles.
+struct TriangleRay
+{
+  Eigen::Vector3d origin;
+  // Permutation of the axes so that kz is the dominant direction component
+  int kx, ky, kz;
+  // Shear constants
+  double sx, sy, sz;
+
+  explicit TriangleRay(const Ray & ray):
+    origin(ray.origin)
+  {
+    const Eigen::Vector3d & d = ray.direction;
+    d.cwiseAbs().maxCoeff(&kz);
+    kx = (kz + 1) % 3;
+    ky = (kx + 1) % 3;
+    // Keep the winding of the triangle when looking down -z
+    if(d(kz) < 0)
+    {
+      std::swap(kx,ky);
+    }
+    sz = 1.0 / d(kz);
+    sx = d(kx) * sz;
+    sy = d(ky) * sz;
+  }
+};
+
+// Intersect a prepared ray with a triangle. Both sides of the triangle count.
+//
+// Inputs:
+//   ray  ray prepared for triangle tests
+//   a,b,c  corners of the triangle
+//   min_t  minimum parametric distance to consider
+// Outputs:
+//   t  parametric distance of the hit
+//   u,v  barycentric coordinates of the hit with respect to b and c (the hit
+//     point is (1-u-v)*a + u*b + v*c)
+// Returns true iff the ray hits the triangle with t >= min_t
+inline bool intersect_triangle(
+  const TriangleRay & ray,
+  const Eigen::Vector3d & a,
+  const Eigen::Vector3d & b,
+  const Eigen::Vector3d & c,
+  const double min_t,
+  double & t,
+  double & u,
+  double & v)
+{
+  // Corners relative to the ray origin
+  const Eigen::Vector3d A = a - ray.origin;
+  const Eigen::Vector3d B = b - ray.origin;
+  const Eigen::Vector3d C = c - ray.origin;
+  // Shear and scale the corners
+  const double ax = A(ray.kx) - ray.sx * A(ray.kz);
+  const double ay = A(ray.ky) - ray.sy * A(ray.kz);
+  const double bx = B(ray.kx) - ray.sx * B(ray.kz);
+  const double by = B(ray.ky) - ray.sy * B(ray.kz);
+  const double cx = C(ray.kx) - ray.sx * C(ray.kz);
+  const double cy = C(ray.ky) - ray.sy * C(ray.kz);
+  // Scaled barycentric coordinates (edge functions)
+  const double U = cx * by - cy * bx;
+  const double V = ax * cy - ay * cx;
+  const double W = bx * ay - by * ax;
+  // Outside unless all edge functions agree in sign. Zeros lie on an edge and
+  // count as inside so that shared edges are covered by both triangles.
+  if((U < 0 || V < 0 || W < 0) && (U > 0 || V > 0 || W > 0))
+  {
+    return false;
+  }
+  const double det = U + V + W;
+  if(det == 0)
+  {
+    // Ray is parallel to the triangle (or the triangle is degenerate)
+    return false;
+  }
+  const double T =
+    ray.sz * (U * A(ray.kz) + V * B(ray.kz) + W * C(ray.kz));
+  t = T / det;
+  if(!(t >= min_t))
+  {
+    return false;
+  }
+  u = V / det;
+  v = W / det;
+  return true;
+}
+
+#endif
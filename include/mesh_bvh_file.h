@@ -0,0 +1,43 @@
+#ifndef MESH_BVH_FILE_H
+#define MESH_BVH_FILE_H
+
+#include "BVH.h"
+#include "TriangleMesh.h"
+#include <cstdint>
+#include <string>
+
+// Built mesh stored next to its .stl file as <mesh>.stl.bvh: welded
+// vertices, faces in BVH slot order and the hierarchy. Reading it back maps
+// the file and skips STL parsing, vertex welding and the hierarchy build.
+//
+// A file records the size, modification time and content hash of the .stl
+// file it was built from, and the build method; a mismatch in any of them
+// marks it stale.
+
+// Read the built mesh of an .stl file.
+//
+// Inputs:
+//   stl_filename  path to .stl file
+//   stl_hash  content hash of the .stl file (see content_hash.h)
+//   method  build method the hierarchy must have been built with
+// Outputs:
+//   mesh  built mesh (left empty on failure)
+// Returns true iff an up to date file written by this version was read
+bool read_mesh_bvh(
+  const std::string & stl_filename,
+  const std::uint64_t stl_hash,
+  const BVH::BuildMethod method,
+  TriangleMesh & mesh);
+// Write the built mesh of an .stl file next to it.
+//
+// Inputs:
+//   stl_filename  path to .stl file the mesh was built from
+//   stl_hash  content hash of the .stl file
+//   mesh  mesh built from the .stl file (see TriangleMesh::build)
+// Returns true on success, false on failure (e.g., can't write file)
+bool write_mesh_bvh(
+  const std::string & stl_filename,
+  const std::uint64_t stl_hash,
+  const TriangleMesh & mesh);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef PARALLEL_FOR_H
+#define PARALLEL_FOR_H
+
+#include <functional>
+
+// Run a task for every index in [0,n) on a pool of worker threads. Indices
+// are handed out one at a time as workers become free, so tasks of very
+// different cost (e.g., loading meshes of different sizes) still balance.
+// Returns once every task has finished.
+//
+// Inputs:
+//   n  number of tasks
+//   task  callable `void task(int i)`, safe to call concurrently for
+//     different i
+//   num_threads  number of worker threads (0 for hardware concurrency, 1 to
+//     run on the calling thread)
+void parallel_for(
+  const int n,
+  const std::function<void(int)> & task,
+  const int num_threads = 0);
+
+#endif
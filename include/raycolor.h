@@ -2,6 +2,7 @@
 #define RAYCOLOR_H
 #include "Ray.h"
 #include "Object.h"
+#include "Scene.h"
 #include "Light.h"
 #include <Eigen/Core>
 #include <vector>
@@ -12,7 +13,7 @@
 //   ray  ray along which to search
 //   min_t  minimum t value to consider (for viewing rays, this is typically at
 //     least the _parametric_ distance of the image plane to the camera)
-//   objects  list of objects (shapes) in the scene
+//   scene  objects (shapes) in the scene and their acceleration structure
 //   lights  list of lights in the scene
 //   num_recursive_calls  how many times has raycolor been called already
 // Outputs:
@@ -21,9 +22,33 @@
 bool raycolor(
   const Ray & ray, 
   const double min_t,
-  const std::vector< std::shared_ptr<Object> > & objects,
+  const Scene & scene,
   const std::vector< std::shared_ptr<Light> > & lights,
   const int num_recursive_calls,
   Eigen::Vector3d & rgb);
+// Same as above, but carry on from the first hit along the ray, found
+// beforehand (e.g., for a whole packet of viewing rays at once, see
+// first_hit).
+//
+// Inputs:
+//   ray  ray along which the hit was found
+//   scene  objects (shapes) in the scene and their acceleration structure
+//   lights  list of lights in the scene
+//   num_recursive_calls  how many times has raycolor been called already
+//   hit_id  index into scene.objects of object hit (-1 if none)
+//   t  _parametric_ distance of the hit along ray
+//   n  surface normal at the hit
+// Outputs:
+//   rgb  collected color
+// Returns true iff there is a hit (hit_id >= 0)
+bool raycolor(
+  const Ray & ray,
+  const Scene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const int num_recursive_calls,
+  const int hit_id,
+  const double t,
+  const Eigen::Vector3d & n,
+  Eigen::Vector3d & rgb);
 
 #endif
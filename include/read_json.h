@@ -17,46 +17,56 @@ struct Light;
 //   camera  camera looking at the scene
 //   objects  list of shared pointers to objects
 //   lights  list of shared pointers to lights
+//   stl_files  if not null, paths of the .stl files the scene references
 inline bool read_json(
   const std::string & filename, 
   Camera & camera,
   std::vector<std::shared_ptr<Object> > & objects,
-  std::vector<std::shared_ptr<Light> > & lights);
+  std::vector<std::shared_ptr<Light> > & lights,
+  std::vector<std::string> * stl_files = nullptr);
 
 // Implementation
 
 #include <json.hpp>
-#include "readSTL.h"
+#include "for_each_json_element.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "parallel_for.h"
 #include "dirname.h"
 #include "Object.h"
 #include "Sphere.h"
 #include "Plane.h"
 #include "Triangle.h"
 #include "TriangleSoup.h"
+#include "Instance.h"
 #include "Light.h"
 #include "PointLight.h"
 #include "DirectionalLight.h"
 #include "Material.h"
 #include <Eigen/Geometry>
-#include <fstream>
 #include <iostream>
+#include <functional>
+#include <map>
+#include <tuple>
 #include <cassert>
+#include <thread>
+#include <algorithm>
 
 inline bool read_json(
   const std::string & filename, 
   Camera & camera,
   std::vector<std::shared_ptr<Object> > & objects,
-  std::vector<std::shared_ptr<Light> > & lights)
+  std::vector<std::shared_ptr<Light> > & lights,
+  std::vector<std::string> * stl_files)
 {
   // Heavily borrowing from
   // https://github.com/yig/graphics101-raycasting/blob/master/parser.cpp
   using json = nlohmann::json;
 
-  std::ifstream infile( filename );
-  if( !infile ) return false;
-  json j;
-  infile >> j;
-
+  // Stream the file element by element rather than holding the DOM of the
+  // whole document next to the scene built from it
+  MappedFile file;
+  if(!file.open(filename)) return false;
 
   // parse a vector
   auto parse_Vector3d = [](const json & j) -> Eigen::Vector3d
@@ -76,122 +86,335 @@ inline bool read_json(
     camera.height = j["height"].get<double>();
     camera.width = j["width"].get<double>();
   };
-  parse_camera(j["camera"],camera);
 
   // Parse materials
   std::unordered_map<std::string,std::shared_ptr<Material> > materials;
-  auto parse_materials = [&parse_Vector3d](
-    const json & j,
+  auto parse_material = [&parse_Vector3d](
+    const json & jmat,
     std::unordered_map<std::string,std::shared_ptr<Material> > & materials)
   {
-    materials.clear();
-    for(const json & jmat : j)
+    std::string name = jmat["name"];
+    std::shared_ptr<Material> material(new Material());
+    material->ka = parse_Vector3d(jmat["ka"]);
+    material->kd = parse_Vector3d(jmat["kd"]);
+    material->ks = parse_Vector3d(jmat["ks"]);
+    material->km = parse_Vector3d(jmat["km"]);
+    material->phong_exponent = jmat["phong_exponent"];
+    materials[name] = material;
+  };
+
+  auto parse_light = [&parse_Vector3d](
+    const json & jlight,
+    std::vector<std::shared_ptr<Light> > & lights)
+  {
+    if(jlight["type"] == "directional")
+    {
+      std::shared_ptr<DirectionalLight> light(new DirectionalLight());
+      light->d = parse_Vector3d(jlight["direction"]).normalized();
+      light->I = parse_Vector3d(jlight["color"]);
+      lights.push_back(light);
+    }else if(jlight["type"] == "point")
     {
-      std::string name = jmat["name"];
-      std::shared_ptr<Material> material(new Material());
-      material->ka = parse_Vector3d(jmat["ka"]);
-      material->kd = parse_Vector3d(jmat["kd"]);
-      material->ks = parse_Vector3d(jmat["ks"]);
-      material->km = parse_Vector3d(jmat["km"]);
-      material->phong_exponent = jmat["phong_exponent"];
-      materials[name] = material;
+      std::shared_ptr<PointLight> light(new PointLight());
+      light->p = parse_Vector3d(jlight["position"]);
+      light->I = parse_Vector3d(jlight["color"]);
+      lights.push_back(light);
     }
   };
-  parse_materials(j["materials"],materials);
 
-  auto parse_lights = [&parse_Vector3d](
-    const json & j,
-    std::vector<std::shared_ptr<Light> > & lights)
+  // Objects may come before the materials they name: those are looked up
+  // once the whole file is read
+  std::vector<std::pair<std::shared_ptr<Object>,std::string> > unresolved;
+  // Meshes are loaded after the pass, all at once
+  std::vector<std::pair<std::shared_ptr<TriangleSoup>,std::string> > soups;
+  // Path of an .stl file named in the scene
+  auto stl_path = [&filename,stl_files](const std::string & stl)
+    -> std::string
+  {
+#if defined(WIN32) || defined(_WIN32)
+#define PATH_SEPARATOR std::string("\\")
+#else
+#define PATH_SEPARATOR std::string("/")
+#endif
+    const std::string path = igl::dirname(filename) + PATH_SEPARATOR + stl;
+    if(stl_files)
+    {
+      stl_files->push_back(path);
+    }
+    return path;
+  };
+  // How to build the hierarchy of a mesh: "bvh": "sah" (default),
+  // "morton" or "sbvh" (spatial splits)
+  auto parse_build_method = [](const json & jobj) -> BVH::BuildMethod
+  {
+    if(jobj.count("bvh") && jobj["bvh"] == "morton")
+    {
+      return BVH::MORTON;
+    }
+    return jobj.count("bvh") && jobj["bvh"] == "sbvh" ?
+      BVH::SPATIAL_SAH : BVH::BINNED_SAH;
+  };
+  // Whether to compress the hierarchy of a mesh: "compress_bvh": true for
+  // meshes too big for the caches (default false)
+  auto parse_compress_bvh = [](const json & jobj) -> bool
+  {
+    return jobj.count("compress_bvh") && jobj["compress_bvh"] == true;
+  };
+  // Soup of each .stl file placed by instances (shared by all of them that
+  // build it the same way)
+  std::map<std::tuple<std::string,BVH::BuildMethod,bool>,
+    std::shared_ptr<TriangleSoup> > stl_soups;
+  auto stl_soup = [&soups,&stl_soups,&stl_path](
+    const std::string & stl, const BVH::BuildMethod method,
+    const bool compress) -> std::shared_ptr<TriangleSoup>
   {
-    lights.clear();
-    for(const json & jlight : j)
+    std::shared_ptr<TriangleSoup> & soup =
+      stl_soups[std::make_tuple(stl,method,compress)];
+    if(!soup)
     {
-      if(jlight["type"] == "directional")
+      soup.reset(new TriangleSoup());
+      soup->build_method = method;
+      soup->compress_bvh = compress;
+      soups.emplace_back(soup,stl_path(stl));
+    }
+    return soup;
+  };
+
+  // Instances name the group they place: groups may come later in the file,
+  // so they are hooked up after the pass
+  struct Group
+  {
+    std::shared_ptr<TriangleSoup> soup;
+    // Groups placed by instances inside this one
+    std::vector<std::string> uses;
+    // 0: not built, 1: being built, 2: built
+    int state = 0;
+  };
+  std::unordered_map<std::string,Group> groups;
+  std::vector<std::pair<std::shared_ptr<Instance>,std::string> >
+    group_instances;
+  auto parse_transform = [&parse_Vector3d](const json & jobj)
+    -> Eigen::Affine3d
+  {
+    Eigen::Affine3d transform = Eigen::Affine3d::Identity();
+    if(jobj.count("matrix"))
+    {
+      // 3 or 4 rows of 4
+      for(int i = 0;i<3;i++)
       {
-        std::shared_ptr<DirectionalLight> light(new DirectionalLight());
-        light->d = parse_Vector3d(jlight["direction"]).normalized();
-        light->I = parse_Vector3d(jlight["color"]);
-        lights.push_back(light);
-      }else if(jlight["type"] == "point")
+        for(int j = 0;j<4;j++)
+        {
+          transform.matrix()(i,j) = jobj["matrix"][i][j].get<double>();
+        }
+      }
+      return transform;
+    }
+    // Scale first, then rotate, then translate
+    if(jobj.count("translate"))
+    {
+      transform.translate(parse_Vector3d(jobj["translate"]));
+    }
+    if(jobj.count("rotate"))
+    {
+      // Angle in degrees
+      const double PI = 3.14159265358979323846;
+      const json & jrotate = jobj["rotate"];
+      transform.rotate(Eigen::AngleAxisd(
+        jrotate["angle"].get<double>()*PI/180.0,
+        parse_Vector3d(jrotate["axis"]).normalized()));
+    }
+    if(jobj.count("scale"))
+    {
+      if(jobj["scale"].is_number())
       {
-        std::shared_ptr<PointLight> light(new PointLight());
-        light->p = parse_Vector3d(jlight["position"]);
-        light->I = parse_Vector3d(jlight["color"]);
-        lights.push_back(light);
+        transform.scale(jobj["scale"].get<double>());
+      }else
+      {
+        transform.scale(parse_Vector3d(jobj["scale"]));
       }
     }
+    return transform;
   };
-  parse_lights(j["lights"],lights);
 
-  auto parse_objects = [&parse_Vector3d,&filename,&materials](
-    const json & j,
-    std::vector<std::shared_ptr<Object> > & objects)
+  // Parse one object, appending it to objects. uses collects the groups
+  // placed by instances (when parsing the objects of a group).
+  auto parse_object = [&parse_Vector3d,&parse_transform,&materials,
+    &unresolved,&soups,&stl_path,&parse_build_method,&parse_compress_bvh,
+    &stl_soup,&group_instances](
+    const json & jobj,
+    std::vector<std::shared_ptr<Object> > & objects,
+    std::vector<std::string> & uses)
   {
-    objects.clear();
-    for(const json & jobj : j)
+    if(jobj["type"] == "sphere")
+    {
+      std::shared_ptr<Sphere> sphere(new Sphere());
+      sphere->center = parse_Vector3d(jobj["center"]);
+      sphere->radius = jobj["radius"].get<double>();
+      objects.push_back(sphere);
+    }else if(jobj["type"] == "plane")
+    {
+      std::shared_ptr<Plane> plane(new Plane());
+      plane->point = parse_Vector3d(jobj["point"]);
+      plane->normal = parse_Vector3d(jobj["normal"]).normalized();
+      objects.push_back(plane);
+    }else if(jobj["type"] == "triangle")
+    {
+      std::shared_ptr<Triangle> tri(new Triangle());
+      tri->corners = std::make_tuple(
+        parse_Vector3d(jobj["corners"][0]),
+        parse_Vector3d(jobj["corners"][1]),
+        parse_Vector3d(jobj["corners"][2]));
+      objects.push_back(tri);
+    }else if(jobj["type"] == "soup")
+    {
+      std::shared_ptr<TriangleSoup> soup(new TriangleSoup());
+      soup->build_method = parse_build_method(jobj);
+      soup->compress_bvh = parse_compress_bvh(jobj);
+      // Filled in once all objects are known
+      soups.emplace_back(soup,stl_path(jobj["stl"]));
+      objects.push_back(soup);
+    }else if(jobj["type"] == "instance")
     {
-      if(jobj["type"] == "sphere")
+      std::shared_ptr<Instance> instance(new Instance());
+      instance->set_transform(parse_transform(jobj));
+      if(jobj.count("stl"))
       {
-        std::shared_ptr<Sphere> sphere(new Sphere());
-        sphere->center = parse_Vector3d(jobj["center"]);
-        sphere->radius = jobj["radius"].get<double>();
-        objects.push_back(sphere);
-      }else if(jobj["type"] == "plane")
+        instance->object = stl_soup(
+          jobj["stl"],parse_build_method(jobj),parse_compress_bvh(jobj));
+      }else
       {
-        std::shared_ptr<Plane> plane(new Plane());
-        plane->point = parse_Vector3d(jobj["point"]);
-        plane->normal = parse_Vector3d(jobj["normal"]).normalized();
-        objects.push_back(plane);
-      }else if(jobj["type"] == "triangle")
+        const std::string group = jobj["group"];
+        group_instances.emplace_back(instance,group);
+        uses.push_back(group);
+      }
+      objects.push_back(instance);
+    }else
+    {
+      return;
+    }
+    //objects.back()->material = default_material;
+    if(jobj.count("material"))
+    {
+      const std::string name = jobj["material"];
+      if(materials.count(name))
       {
-        std::shared_ptr<Triangle> tri(new Triangle());
-        tri->corners = std::make_tuple(
-          parse_Vector3d(jobj["corners"][0]),
-          parse_Vector3d(jobj["corners"][1]),
-          parse_Vector3d(jobj["corners"][2]));
-        objects.push_back(tri);
-      }else if(jobj["type"] == "soup")
+        objects.back()->material = materials[name];
+      }else
       {
-        std::vector<std::vector<double> > V;
-        std::vector<std::vector<double> > F;
-        std::vector<std::vector<int> > N;
-        {
-#if defined(WIN32) || defined(_WIN32)
-#define PATH_SEPARATOR std::string("\\")
-#else
-#define PATH_SEPARATOR std::string("/")
-#endif
-          const std::string stl_path = jobj["stl"];
-          igl::readSTL(
-              igl::dirname(filename)+
-              PATH_SEPARATOR +
-              stl_path,
-              V,F,N);
-        }
-        std::shared_ptr<TriangleSoup> soup(new TriangleSoup());
-        for(int f = 0;f<F.size();f++)
-        {
-          std::shared_ptr<Triangle> tri(new Triangle());
-          tri->corners = std::make_tuple(
-            Eigen::Vector3d( V[F[f][0]][0], V[F[f][0]][1], V[F[f][0]][2]),
-            Eigen::Vector3d( V[F[f][1]][0], V[F[f][1]][1], V[F[f][1]][2]),
-            Eigen::Vector3d( V[F[f][2]][0], V[F[f][2]][1], V[F[f][2]][2])
-          );
-          soup->triangles.push_back(tri);
-        }
-        objects.push_back(soup);
+        unresolved.emplace_back(objects.back(),name);
       }
-      //objects.back()->material = default_material;
-      if(jobj.count("material"))
+    }
+  };
+
+  auto parse_group = [&parse_object,&groups](const json & jgroup)
+  {
+    Group & group = groups[jgroup["name"]];
+    group.soup.reset(new TriangleSoup());
+    for(const json & jobj : jgroup["objects"])
+    {
+      parse_object(jobj,group.soup->triangles,group.uses);
+    }
+  };
+  // Build the hierarchy of a group after those of the groups it places
+  // (their boxes are needed). Returns false on a cycle.
+  std::function<bool(Group &)> build_group = [&](Group & group) -> bool
+  {
+    if(group.state == 1)
+    {
+      return false;
+    }
+    if(group.state == 0)
+    {
+      group.state = 1;
+      for(const std::string & name : group.uses)
       {
-        if(materials.count(jobj["material"]))
+        if(groups.count(name) && !build_group(groups[name]))
         {
-          objects.back()->material = materials[jobj["material"]];
+          return false;
         }
       }
+      group.soup->build();
+      group.state = 2;
     }
+    return true;
   };
-  parse_objects(j["objects"],objects);
+
+  objects.clear();
+  lights.clear();
+  bool has_camera = false;
+  // Top-level objects place no groups of their own
+  std::vector<std::string> top_level_uses;
+  std::string error;
+  const bool success = for_each_json_element(
+    file.data(),
+    file.data() + file.size(),
+    [&](const std::string & key, json & value)
+    {
+      if(key == "camera")
+      {
+        parse_camera(value,camera);
+        has_camera = true;
+      }else if(key == "materials")
+      {
+        parse_material(value,materials);
+      }else if(key == "lights")
+      {
+        parse_light(value,lights);
+      }else if(key == "objects")
+      {
+        parse_object(value,objects,top_level_uses);
+      }else if(key == "groups")
+      {
+        parse_group(value);
+      }
+    },
+    error);
+  if(!success || !has_camera)
+  {
+    std::cerr<<"Error: "<<filename<<": "<<
+      (success ? "no camera" : error)<<std::endl;
+    return false;
+  }
+  // Each soup already holds its place in objects, so loading and building
+  // them concurrently keeps the scene identical to a serial load. Soups of
+  // the same file (in this scene or an earlier one) share one mesh. The
+  // cores are shared out between the concurrent loads, so that their builds
+  // together use about one thread per core.
+  const int cores = std::max<int>(std::thread::hardware_concurrency(),1);
+  const int build_threads = std::max<int>(
+    cores/std::max<int>(std::min<int>(soups.size(),cores),1),1);
+  parallel_for(soups.size(),[&soups,build_threads](const int i)
+  {
+    soups[i].first->mesh = mesh_cache().load(
+      soups[i].second,soups[i].first->build_method,
+      soups[i].first->compress_bvh,build_threads);
+  });
+  for(const auto & instance_group : group_instances)
+  {
+    if(!groups.count(instance_group.second))
+    {
+      std::cerr<<"Error: "<<filename<<": no group named "<<
+        instance_group.second<<std::endl;
+      return false;
+    }
+    instance_group.first->object = groups[instance_group.second].soup;
+  }
+  for(auto & name_group : groups)
+  {
+    if(!build_group(name_group.second))
+    {
+      std::cerr<<"Error: "<<filename<<": group "<<name_group.first<<
+        " places itself"<<std::endl;
+      return false;
+    }
+  }
+  for(const auto & object_material : unresolved)
+  {
+    if(materials.count(object_material.second))
+    {
+      object_material.first->material = materials[object_material.second];
+    }
+  }
 
   return true;
 }
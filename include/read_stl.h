@@ -0,0 +1,24 @@
+#ifndef READ_STL_H
+#define READ_STL_H
+
+#include <Eigen/Core>
+#include <string>
+#include <vector>
+
+// Read a triangle mesh from an .stl file as a flat list of corners. Files are
+// memory mapped. Binary 50-byte facet records are converted straight into
+// the output, with a single allocation for the whole mesh; large ascii files
+// are split at facet boundaries and parsed by several threads.
+//
+// Inputs:
+//   filename  path to .stl file (binary or ascii)
+// Outputs:
+//   corners  3*#F list of triangle corners: triangle f has corners
+//     corners[3*f], corners[3*f+1], corners[3*f+2]
+// Returns true on success, false on failure (e.g., can't open file, file is
+//   truncated)
+bool read_stl(
+  const std::string & filename,
+  std::vector<Eigen::Vector3d> & corners);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "Camera.h"
+#include "Light.h"
+#include "Scene.h"
+#include <memory>
+#include <vector>
+
+// Render a lit scene into an 8-bit rgb image. The image is cut into square
+// tiles which are dealt out to a pool of worker threads; a worker that runs
+// out of tiles steals from the others, so expensive regions (e.g. many
+// mirror bounces) do not leave threads idle. Each pixel is computed
+// independently, so the result does not depend on the number of threads.
+// The viewing rays of square blocks of pixels are traced into the scene as
+// packets (see first_hit); reflections are traced ray by ray.
+//
+// Inputs:
+//   camera  camera looking at the scene
+//   scene  objects in the scene and their acceleration structure
+//   lights  list of lights in the scene
+//   width  image width (i.e., number of columns)
+//   height  image height (i.e., number of rows)
+//   num_threads  number of worker threads (0 for hardware concurrency, 1 to
+//     render on the calling thread)
+//   packet_size  edge length in pixels of the blocks traced as packets: 4
+//     or 8 (1 traces every viewing ray on its own)
+// Outputs:
+//   rgb_image  3*width*height list of rgb intensities, row by row
+void render(
+  const Camera & camera,
+  const Scene & scene,
+  const std::vector<std::shared_ptr<Light> > & lights,
+  const int width,
+  const int height,
+  const int num_threads,
+  const int packet_size,
+  std::vector<unsigned char> & rgb_image);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "Camera.h"
+#include "Light.h"
+#include "Object.h"
+#include "BVH.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Binary cache of a .json scene, stored next to it as <scene>.json.cache:
+// camera, materials, lights, primitives, indexed meshes with their BVHs and
+// the BVH of the whole scene. Reading it back skips JSON parsing, STL
+// loading, vertex welding and every hierarchy build.
+//
+// A cache is keyed by the content hash of the .json file and of every .stl
+// file it references, so editing any of them invalidates it.
+
+// Read a scene from the cache of a .json file.
+//
+// Inputs:
+//   filename  path to .json file
+// Outputs:
+//   camera  camera looking at the scene
+//   objects  list of shared pointers to objects
+//   lights  list of shared pointers to lights
+//   scene_bvh  hierarchy for Scene::build(const BVH &) over objects
+// Returns true iff a cache written by this version for the current contents
+//   of the scene and its meshes was read
+bool read_scene_cache(
+  const std::string & filename,
+  Camera & camera,
+  std::vector<std::shared_ptr<Object> > & objects,
+  std::vector<std::shared_ptr<Light> > & lights,
+  BVH & scene_bvh);
+// Write the cache of a .json scene.
+//
+// Inputs:
+//   filename  path to .json file the scene was read from
+//   stl_files  paths of the .stl files it references
+//   camera  camera looking at the scene
+//   objects  list of shared pointers to objects
+//   lights  list of shared pointers to lights
+//   scene_bvh  bvh of the Scene built from objects
+// Returns true on success, false on failure (e.g., can't write file, or the
+//   scene holds object or light types the cache does not know)
+bool write_scene_cache(
+  const std::string & filename,
+  const std::vector<std::string> & stl_files,
+  const Camera & camera,
+  const std::vector<std::shared_ptr<Object> > & objects,
+  const std::vector<std::shared_ptr<Light> > & lights,
+  const BVH & scene_bvh);
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstdint>
+#include <string>
+
+// Innermost loops of the ray tracer, compiled several times for different
+// instruction sets (see src/simd/kernels.cpp and CMakeLists.txt). The best
+// set the CPU supports is picked at start up, so one binary runs everywhere
+// and still uses wide vectors where they exist.
+//
+// Kernels work on structure-of-arrays primitive batches (see SphereBatch,
+// TriangleBatch, PlaneBatch) over a range of slots [begin,end). Arrays must
+// be padded with SIMD_MAX_LANES-1 entries past the last slot so that full
+// vector loads stay in bounds. Every variant performs the same IEEE
+// operations in the same order as the scalar Sphere, Triangle and Plane
+// code, so all variants give bit-identical results.
+//
+// Kernel source may not use Eigen or other header-defined (inline) code: the
+// linker would be free to keep a copy compiled for the widest instruction
+// set and call it on CPUs without it.
+
+// Widest vector, in doubles
+const int SIMD_MAX_LANES = 8;
+// Most rays in a packet (see RayPacket)
+const int SIMD_PACKET_SIZE = 64;
+
+// Ray as plain arrays
+struct SimdRay
+{
+  double origin[3];
+  double direction[3];
+};
+
+// Ray set up for watertight triangle tests (see TriangleRay)
+struct SimdTriangleRay
+{
+  double origin[3];
+  int kx, ky, kz;
+  double sx, sy, sz;
+};
+
+// Rays of a packet set up for watertight triangle tests, all with the same
+// axis permutation, as arrays with one entry per ray (padded with
+// SIMD_MAX_LANES-1 entries for full vector loads)
+struct SimdTrianglePacket
+{
+  int kx, ky, kz;
+  // Origin coordinates along kx, ky and kz
+  double ox[SIMD_PACKET_SIZE+SIMD_MAX_LANES-1];
+  double oy[SIMD_PACKET_SIZE+SIMD_MAX_LANES-1];
+  double oz[SIMD_PACKET_SIZE+SIMD_MAX_LANES-1];
+  // Shear constants
+  double sx[SIMD_PACKET_SIZE+SIMD_MAX_LANES-1];
+  double sy[SIMD_PACKET_SIZE+SIMD_MAX_LANES-1];
+  double sz[SIMD_PACKET_SIZE+SIMD_MAX_LANES-1];
+};
+
+struct SimdKernels
+{
+  // Name of the instruction set: "sse2" (or "scalar"), "avx2", "avx512"
+  const char * isa;
+  // Doubles per vector
+  int lanes;
+
+  // Closest sphere hit with t in [min_t, *max_t) among slots [begin,end) of
+  // centers (cx,cy,cz) and radii r. Shrinks *max_t to the hit and returns its
+  // slot (the lowest one among ties), or -1 if there is none.
+  int (*sphere_closest_hit)(
+    const SimdRay & ray, const double min_t,
+    const double * cx, const double * cy, const double * cz, const double * r,
+    const int begin, const int end, double * max_t);
+  // Whether any sphere among slots [begin,end) is hit with t in
+  // [min_t, max_t]
+  bool (*sphere_any_hit)(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const double * cx, const double * cy, const double * cz, const double * r,
+    const int begin, const int end);
+
+  // Closest triangle hit with t in [min_t, *max_t) among slots [begin,end).
+  // corners[0..8] are the arrays ax,ay,az,bx,by,bz,cx,cy,cz. Shrinks *max_t,
+  // stores the barycentric coordinates of the hit in u,v and returns its
+  // slot, or -1 if there is none.
+  int (*triangle_closest_hit)(
+    const SimdTriangleRay & ray, const double min_t,
+    const double * const * corners,
+    const int begin, const int end, double * max_t, double * u, double * v);
+  // Whether any triangle among slots [begin,end) is hit with t in
+  // [min_t, max_t]
+  bool (*triangle_any_hit)(
+    const SimdTriangleRay & ray, const double min_t, const double max_t,
+    const double * const * corners,
+    const int begin, const int end);
+
+  // Same as triangle_closest_hit, for an indexed mesh: slot s has corners
+  // vertices + 3*faces[3*s+0,1,2] (x,y,z interleaved). No padding needed.
+  int (*indexed_triangle_closest_hit)(
+    const SimdTriangleRay & ray, const double min_t,
+    const double * vertices, const std::uint32_t * faces,
+    const int begin, const int end, double * max_t, double * u, double * v);
+  // Same as triangle_any_hit, for an indexed mesh
+  bool (*indexed_triangle_any_hit)(
+    const SimdTriangleRay & ray, const double min_t, const double max_t,
+    const double * vertices, const std::uint32_t * faces,
+    const int begin, const int end);
+  // Same as indexed_triangle_closest_hit, for the rays [first,last) of a
+  // packet, with rays rather than triangles in the lanes. For every ray r
+  // hitting a triangle closer than max_t[r] (the lowest slot among ties),
+  // shrinks max_t[r] and stores the barycentric coordinates of the hit in
+  // u[r], v[r] and its slot in closest[r]. Returns true iff any ray hit.
+  bool (*indexed_triangle_packet_closest_hit)(
+    const SimdTrianglePacket & packet, const double min_t,
+    const double * vertices, const std::uint32_t * faces,
+    const int begin, const int end, const int first, const int last,
+    double * max_t, double * u, double * v, int * closest);
+
+  // Closest plane hit with t in (min_t, *max_t) among slots [begin,end) of
+  // planes through points (px,py,pz) with normals (nx,ny,nz)
+  int (*plane_closest_hit)(
+    const SimdRay & ray, const double min_t,
+    const double * const * planes,
+    const int begin, const int end, double * max_t);
+  // Whether any plane among slots [begin,end) is hit with t in
+  // (min_t, max_t]. planes[0..5] are the arrays nx,ny,nz,px,py,pz.
+  bool (*plane_any_hit)(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const double * const * planes,
+    const int begin, const int end);
+
+  // Slab test of a ray against count <= SIMD_MAX_LANES boxes, with the same
+  // operations as ray_box_intersect (see BVH.h). ray.direction holds the
+  // componentwise inverse of the ray direction. bounds[0..5] are the arrays
+  // min x,y,z, max x,y,z (full vector loads from them must stay in bounds).
+  // Stores the entry distance of every box in t_enter (which must hold
+  // SIMD_MAX_LANES doubles) and returns the bit mask of the boxes hit within
+  // [min_t, max_t].
+  int (*box_hits)(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const double * const * bounds, const int count, double * t_enter);
+  // Same as box_hits, for boxes quantized to bytes: bounds holds 6 arrays of
+  // SIMD_MAX_LANES bytes (min x,y,z, max x,y,z), and a box's coordinate on
+  // axis a is origin[a] + q*scale[a] for its byte q, evaluated in double.
+  int (*quantized_box_hits)(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const float * origin, const float * scale,
+    const unsigned char * bounds, const int count, double * t_enter);
+
+  // Convert count color intensities to bytes: 255*clamp(x,0,1) truncated
+  void (*quantize)(const double * in, const int count, unsigned char * out);
+};
+
+// Kernels for the active instruction set (by default the best one this CPU
+// supports)
+const SimdKernels & simd_kernels();
+// Activate the kernels of a given instruction set.
+//
+// Inputs:
+//   isa  name of the instruction set ("sse2", "avx2" or "avx512")
+// Returns true iff this binary has kernels for isa and the CPU supports it
+bool select_simd_kernels(const std::string & isa);
+// Space separated names of all instruction sets available on this CPU
+std::string available_simd_kernels();
+
+#endif
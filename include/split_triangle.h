@@ -0,0 +1,29 @@
+#ifndef SPLIT_TRIANGLE_H
+#define SPLIT_TRIANGLE_H
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+// Split a triangle by an axis-aligned plane and bound the parts on either
+// side of it (used by spatial split BVH builds). Each box contains its part
+// exactly, despite rounding in the computed edge crossings.
+//
+// Inputs:
+//   a  first corner of triangle
+//   b  second corner of triangle
+//   c  third corner of triangle
+//   axis  axis the plane is perpendicular to (0, 1 or 2)
+//   position  coordinate of the plane along axis
+// Outputs:
+//   left  box around the part with coordinate <= position (empty if none)
+//   right  box around the part with coordinate >= position (empty if none)
+void split_triangle(
+  const Eigen::Vector3d & a,
+  const Eigen::Vector3d & b,
+  const Eigen::Vector3d & c,
+  const int axis,
+  const double position,
+  Eigen::AlignedBox3d & left,
+  Eigen::AlignedBox3d & right);
+
+#endif
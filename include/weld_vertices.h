@@ -0,0 +1,24 @@
+#ifndef WELD_VERTICES_H
+#define WELD_VERTICES_H
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <vector>
+
+// Merge corners at identical positions into shared vertices, turning a
+// triangle soup (as stored in .stl files, three independent corners per
+// face) into an indexed mesh. Only exactly equal positions are merged, so
+// the geometry is unchanged.
+//
+// Inputs:
+//   corners  3*#F list of triangle corners: triangle f has corners
+//     corners[3*f], corners[3*f+1], corners[3*f+2]
+// Outputs:
+//   vertices  #V list of distinct vertex positions, in order of first use
+//   faces  3*#F list of indices into vertices, one triple per triangle
+void weld_vertices(
+  const std::vector<Eigen::Vector3d> & corners,
+  std::vector<Eigen::Vector3d> & vertices,
+  std::vector<std::uint32_t> & faces);
+
+#endif
@@ -12,12 +12,15 @@
 //   width  image width (i.e., number of columns)
 //   height  image height (i.e., number of rows)
 //   num_channels  number of channels (e.g., for rgb 3, for grayscale 1)
+//   ascii  whether to write plain-text P3 (rgb) / P2 (grayscale) instead of
+//     the much smaller and faster binary P6 / P5
 // Returns true on success, false on failure (e.g., can't open file)
 bool write_ppm(
   const std::string & filename,
   const std::vector<unsigned char> & data,
   const int width,
   const int height,
-  const int num_channels);
+  const int num_channels,
+  const bool ascii = false);
 
 #endif
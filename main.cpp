@@ -3,12 +3,18 @@
 #include "Light.h"
 #include "Sphere.h"
 #include "Plane.h"
+#include "Triangle.h"
+#include "Instance.h"
 #include "PointLight.h"
 #include "DirectionalLight.h"
+#include "TriangleSoup.h"
+#include "MeshCache.h"
+#include "Scene.h"
 #include "read_json.h"
+#include "scene_cache.h"
 #include "write_ppm.h"
-#include "viewing_ray.h"
-#include "raycolor.h"
+#include "render.h"
+#include "simd_kernels.h"
 #include "text_overlay.h"
 #include <Eigen/Core>
 #include <vector>
@@ -16,12 +22,27 @@
 #include <memory>
 #include <limits>
 #include <functional>
+#include <chrono>
+#include <fstream>
 #include <random>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <cstdlib>
 
-int main(int argc, char * argv[])
+// Programmatic showcase scene: a pile of chocolate truffles inside a box of
+// mirrors.
+//
+// Outputs:
+//   camera  camera looking at the pile
+//   objects  list of shared pointers to objects
+//   lights  list of shared pointers to lights
+static void truffle_scene(
+  Camera & camera,
+  std::vector<std::shared_ptr<Object> > & objects,
+  std::vector<std::shared_ptr<Light> > & lights)
 {
   // --- SCENE SETUP ---
-  Camera camera;
   camera.e = Eigen::Vector3d(0, 5, 16); // Moved camera closer
   
   // Calculate camera basis vectors
@@ -38,13 +59,6 @@ int main(int argc, char * argv[])
   camera.height = 1.0; // Physical height of image plane
   camera.width = aspect_ratio * camera.height;
 
-  // Pixel resolution
-  int width =  640;
-  int height = 360;
-
-  std::vector< std::shared_ptr<Object> > objects;
-  std::vector< std::shared_ptr<Light> > lights;
-
   // 1. Mirror Floor
   auto mirror_mat = std::make_shared<Material>();
   mirror_mat->ka = Eigen::Vector3d(0.0, 0.0, 0.0);
@@ -155,36 +169,243 @@ int main(int argc, char * argv[])
   point_light->p = Eigen::Vector3d(0, 9, 10); // Single light on top front
   point_light->I = Eigen::Vector3d(1.5, 1.5, 1.5);
   lights.push_back(point_light);
+}
+
+// Move an object of one of the built-in types in place (call Scene::update
+// afterwards).
+//
+// Inputs:
+//   object  object to move
+//   offset  translation to apply
+// Returns false if the object's type can't be moved (e.g., a soup of a
+//   shared mesh: place it with an Instance instead)
+static bool translate_object(Object & object, const Eigen::Vector3d & offset)
+{
+  if(Sphere * sphere = dynamic_cast<Sphere *>(&object))
+  {
+    sphere->center += offset;
+  }else if(Triangle * triangle = dynamic_cast<Triangle *>(&object))
+  {
+    std::get<0>(triangle->corners) += offset;
+    std::get<1>(triangle->corners) += offset;
+    std::get<2>(triangle->corners) += offset;
+  }else if(Plane * plane = dynamic_cast<Plane *>(&object))
+  {
+    plane->point += offset;
+  }else if(Instance * instance = dynamic_cast<Instance *>(&object))
+  {
+    instance->set_transform(
+      Eigen::Translation3d(offset) * instance->transform());
+  }else
+  {
+    return false;
+  }
+  return true;
+}
 
+int main(int argc, char * argv[])
+{
+  // Usage: raytracing [scene.json] [--threads N] [--ascii] [--stats]
+  //   [--isa sse2|avx2|avx512] [--cpu-info] [--no-cache] [--mesh-budget MB]
+  //   [--bvh-width 2|4|8] [--packet-size 1|4|8] [--animate FRAMES]
+  //   [--moving PERCENT]
+  std::string scene_path;
+  bool print_stats = false;
+  // Read and write <scene.json>.cache (and <mesh.stl>.bvh)
+  bool use_cache = true;
+  // Write plain-text P3 instead of binary P6
+  bool ascii_ppm = false;
+  // 0 means one per hardware thread
+  int num_threads = 0;
+  // Viewing rays of blocks of packet_size x packet_size pixels are traced
+  // together (1 traces each on its own)
+  int packet_size = 8;
+  // Frames to render; after the first, a share of the objects drifts each
+  // frame and the scene is updated rather than rebuilt
+  int num_frames = 1;
+  double moving_percent = 5;
+  for(int a = 1;a<argc;a++)
+  {
+    const std::string arg = argv[a];
+    if(arg == "--stats")
+    {
+      print_stats = true;
+      BVH::set_collect_stats(true);
+    }else if(arg == "--ascii")
+    {
+      ascii_ppm = true;
+    }else if(arg == "--no-cache")
+    {
+      use_cache = false;
+      mesh_cache().set_use_files(false);
+    }else if(arg == "--mesh-budget" && a+1<argc)
+    {
+      mesh_cache().set_budget(std::atof(argv[++a])*1e6);
+    }else if(arg == "--bvh-width" && a+1<argc)
+    {
+      // Children per node traversed (2 traverses the binary hierarchy)
+      const int width = std::atoi(argv[++a]);
+      if(width != 2 && width != 4 && width != 8)
+      {
+        std::cerr<<"Error: --bvh-width must be 2, 4 or 8"<<std::endl;
+        return EXIT_FAILURE;
+      }
+      BVH::set_default_width(width);
+    }else if(arg == "--packet-size" && a+1<argc)
+    {
+      packet_size = std::atoi(argv[++a]);
+      if(packet_size != 1 && packet_size != 4 && packet_size != 8)
+      {
+        std::cerr<<"Error: --packet-size must be 1, 4 or 8"<<std::endl;
+        return EXIT_FAILURE;
+      }
+    }else if(arg == "--animate" && a+1<argc)
+    {
+      num_frames = std::max(std::atoi(argv[++a]),1);
+    }else if(arg == "--moving" && a+1<argc)
+    {
+      moving_percent = std::atof(argv[++a]);
+    }else if(arg == "--threads" && a+1<argc)
+    {
+      num_threads = std::atoi(argv[++a]);
+    }else if(arg == "--isa" && a+1<argc)
+    {
+      // Override the SIMD kernels picked for this CPU
+      if(!select_simd_kernels(argv[++a]))
+      {
+        std::cerr<<"Error: no "<<argv[a]<<" kernels for this CPU (have "<<
+          available_simd_kernels()<<")"<<std::endl;
+        return EXIT_FAILURE;
+      }
+    }else if(arg == "--cpu-info")
+    {
+      std::cout<<"SIMD kernels: "<<simd_kernels().isa<<" ("<<
+        simd_kernels().lanes<<" doubles per vector), available: "<<
+        available_simd_kernels()<<std::endl;
+      return EXIT_SUCCESS;
+    }else
+    {
+      scene_path = arg;
+    }
+  }
 
-  std::vector<unsigned char> rgb_image(3*width*height);
+  Camera camera;
+  std::vector< std::shared_ptr<Object> > objects;
+  std::vector< std::shared_ptr<Light> > lights;
 
-  // Random number generator for AA
-  std::default_random_engine generator;
-  std::uniform_real_distribution<double> distribution(-0.5, 0.5);
-  int num_samples = 1; // Keep 1 for now until viewing_ray is fixed
+  // Pixel resolution
+  int width =  640;
+  int height = 360;
 
-  // For each pixel (i,j)
-  for(unsigned i=0; i<height; ++i) 
+  const auto load_start = std::chrono::steady_clock::now();
+  // Hierarchy of the whole scene, when read back from the cache
+  BVH cached_bvh;
+  bool from_cache = false;
+  std::vector<std::string> stl_files;
+  // Time spent in read_json (including the .stl files it loads)
+  double parse_ms = 0;
+  if(scene_path.empty())
+  {
+    truffle_scene(camera,objects,lights);
+  }else
   {
-    for(unsigned j=0; j<width; ++j)
+    from_cache = use_cache &&
+      read_scene_cache(scene_path,camera,objects,lights,cached_bvh);
+    if(!from_cache)
     {
-      // Set background color
-      Eigen::Vector3d rgb(0,0,0);
+      const auto parse_start = std::chrono::steady_clock::now();
+      if(!read_json(scene_path,camera,objects,lights,&stl_files))
+      {
+        std::cerr<<"Error: could not read "<<scene_path<<std::endl;
+        return EXIT_FAILURE;
+      }
+      parse_ms = std::chrono::duration<double,std::milli>(
+        std::chrono::steady_clock::now() - parse_start).count();
+    }
+    // Match the aspect ratio of the scene's image plane
+    height = std::lround(width * camera.height / camera.width);
+  }
 
-      // Compute viewing ray
-      Ray ray;
-      viewing_ray(camera,i,j,width,height,ray);
-      
-      // Shoot ray and collect color
-      raycolor(ray,1.0,objects,lights,0,rgb);
+  // Organize objects for fast ray queries
+  Scene scene;
+  scene.objects = objects;
+  if(from_cache)
+  {
+    scene.build(cached_bvh);
+  }else
+  {
+    scene.build();
+    if(use_cache && !scene_path.empty() &&
+      !write_scene_cache(scene_path,stl_files,camera,objects,lights,scene.bvh))
+    {
+      std::cerr<<"Warning: could not write cache of "<<scene_path<<std::endl;
+    }
+  }
+  const double load_ms = std::chrono::duration<double,std::milli>(
+    std::chrono::steady_clock::now() - load_start).count();
 
-      // Write double precision color into image
-      auto clamp = [](double s){ return std::max(std::min(s,1.0),0.0);};
-      rgb_image[0+3*(j+width*i)] = 255.0*clamp(rgb(0));
-      rgb_image[1+3*(j+width*i)] = 255.0*clamp(rgb(1));
-      rgb_image[2+3*(j+width*i)] = 255.0*clamp(rgb(2));
+  std::vector<unsigned char> rgb_image;
+  const auto render_start = std::chrono::steady_clock::now();
+  render(camera,scene,lights,width,height,num_threads,packet_size,rgb_image);
+  double render_ms = std::chrono::duration<double,std::milli>(
+    std::chrono::steady_clock::now() - render_start).count();
 
+  if(num_frames > 1)
+  {
+    // Every movable object gets a fixed velocity of about 1% of the scene's
+    // size per frame, and each frame a random share of them moves
+    // (moving by zero tells which objects can move)
+    std::vector<int> movable;
+    for(int i = 0;i<(int)objects.size();i++)
+    {
+      if(translate_object(*objects[i],Eigen::Vector3d::Zero()))
+      {
+        movable.push_back(i);
+      }
+    }
+    const double step = scene.bvh.empty() ? 0.01 :
+      0.01*scene.bvh.nodes[0].box.sizes().norm();
+    std::mt19937 rng(0);
+    std::normal_distribution<double> normal;
+    std::vector<Eigen::Vector3d> velocities(movable.size());
+    for(Eigen::Vector3d & velocity : velocities)
+    {
+      velocity = Eigen::Vector3d(normal(rng),normal(rng),normal(rng));
+      velocity *= step/std::max(velocity.norm(),1e-12);
+    }
+    const int num_moving = std::min<int>(movable.size(),
+      std::max(1.0,std::round(moving_percent/100*movable.size())));
+    std::cout<<"frame 0: built, render "<<render_ms<<" ms"<<std::endl;
+    if(num_moving == 0)
+    {
+      std::cout<<"no objects of a movable type to animate"<<std::endl;
+    }
+    for(int frame = 1;frame<num_frames && num_moving > 0;frame++)
+    {
+      std::vector<int> moving(movable.size());
+      for(int m = 0;m<(int)moving.size();m++)
+      {
+        moving[m] = m;
+      }
+      std::shuffle(moving.begin(),moving.end(),rng);
+      moving.resize(num_moving);
+      std::vector<int> changed;
+      for(const int m : moving)
+      {
+        translate_object(*objects[movable[m]],velocities[m]);
+        changed.push_back(movable[m]);
+      }
+      const Scene::UpdateStats update = scene.update(changed);
+      const auto frame_start = std::chrono::steady_clock::now();
+      render(
+        camera,scene,lights,width,height,num_threads,packet_size,rgb_image);
+      render_ms = std::chrono::duration<double,std::milli>(
+        std::chrono::steady_clock::now() - frame_start).count();
+      std::cout<<"frame "<<frame<<": "<<update.changed<<" objects moved, "<<
+        (update.rebuilt ? "rebuilt" : "refit")<<", SAH cost "<<
+        update.sah_cost<<" ("<<update.built_sah_cost<<" after build), "<<
+        "update "<<update.update_ms<<" ms, render "<<render_ms<<" ms"<<
+        std::endl;
     }
   }
 
@@ -192,9 +413,47 @@ int main(int argc, char * argv[])
   std::vector<unsigned char> white = {255, 255, 255};
   std::vector<unsigned char> yellow = {255, 255, 0};
   std::vector<unsigned char> black = {0, 0, 0};
-  draw_text(rgb_image, width, height, "Truffle Pile in Mirror Box", 10, 10, black, 2);
-  draw_text(rgb_image, width, height, "Infinite Reflections", 10, 30, yellow, 1);
-  draw_text(rgb_image, width, height, "CSC317 Fall 2025 - Tianle Xu", 10, height - 20, white, 1);
+  if(scene_path.empty())
+  {
+    draw_text(rgb_image, width, height, "Truffle Pile in Mirror Box", 10, 10, black, 2);
+    draw_text(rgb_image, width, height, "Infinite Reflections", 10, 30, yellow, 1);
+    draw_text(rgb_image, width, height, "CSC317 Fall 2025 - Tianle Xu", 10, height - 20, white, 1);
+  }
+
+  write_ppm("piece.ppm",rgb_image,width,height,3,ascii_ppm);
 
-  write_ppm("piece.ppm",rgb_image,width,height,3);
+  if(print_stats)
+  {
+    std::cout<<"scene loaded in "<<load_ms<<" ms"<<
+      (from_cache ? " (from cache)" : "")<<std::endl;
+    if(parse_ms > 0)
+    {
+      const double megabytes = std::ifstream(
+        scene_path,std::ios::binary | std::ios::ate).tellg() / 1e6;
+      std::cout<<"  parse: "<<megabytes<<" MB, "<<objects.size()<<
+        " objects in "<<parse_ms<<" ms ("<<megabytes/(parse_ms/1000)<<
+        " MB/s, "<<objects.size()/(parse_ms/1000)<<" objects/s)"<<std::endl;
+    }
+    std::cout<<"frame rendered in "<<render_ms<<" ms ("<<
+      (packet_size > 1 ?
+        std::to_string(packet_size) + "x" + std::to_string(packet_size) +
+        " packets" : "no packets")<<")"<<std::endl;
+    std::cout<<"scene BVH ("<<
+      scene.unbounded.size() + scene.planes.size()<<
+      " unbounded objects, "<<simd_kernels().isa<<" kernels):"<<std::endl;
+    scene.bvh.print_stats(std::cout);
+    for(int i = 0;i<(int)objects.size();i++)
+    {
+      const TriangleSoup * soup =
+        dynamic_cast<const TriangleSoup *>(objects[i].get());
+      if(soup)
+      {
+        std::cout<<"soup "<<i<<" ("<<soup->size()<<" triangles, "<<
+          (soup->mesh ? soup->mesh->vertices.size() : 0)<<
+          " vertices) BVH:"<<std::endl;
+        soup->hierarchy().print_stats(std::cout);
+      }
+    }
+    mesh_cache().print_stats(std::cout);
+  }
 }
@@ -0,0 +1,1429 @@
+#include "BVH.h"
+#include "binary_io.h"
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+  // Number of candidate split buckets per axis
+  const int NUM_BINS = 16;
+  // Traversal uses a fixed size stack, so force leaves below this depth
+  const int MAX_DEPTH = 60;
+  // Relative cost of visiting a node versus intersecting a primitive
+  const double TRAVERSAL_COST = 1.0;
+  const double INTERSECTION_COST = 1.0;
+  // Subtrees of at least this many primitives may be built on another
+  // thread
+  const int PARALLEL_MIN_SIZE = 4096;
+  // Bits per axis of a Morton code
+  const int MORTON_BITS = 21;
+  // Spatial splits may add up to this fraction of extra references
+  const double SPATIAL_BUDGET = 0.3;
+  // Spatial splits are only tried where the children of the best object
+  // split overlap by more than this fraction of the root's area
+  const double SPATIAL_OVERLAP = 1e-5;
+
+  // Half the surface area of a box (the factor of two cancels in SAH ratios)
+  double half_area(const Eigen::AlignedBox3d & box)
+  {
+    if(box.isEmpty())
+    {
+      return 0;
+    }
+    const Eigen::Vector3d d = box.sizes();
+    return d(0)*d(1) + d(1)*d(2) + d(2)*d(0);
+  }
+
+  // SAH cost of a node per unit of probability of being hit
+  double node_cost(const BVH::Node & node)
+  {
+    return node.count > 0 ? INTERSECTION_COST * node.count : TRAVERSAL_COST;
+  }
+
+  double total_weighted_area(const std::vector<BVH::Node> & nodes)
+  {
+    double sum = 0;
+    for(const BVH::Node & node : nodes)
+    {
+      sum += node_cost(node) * half_area(node.box);
+    }
+    return sum;
+  }
+
+  // Hand out spare threads to subtrees
+  bool take_thread(std::atomic<int> & spare_threads)
+  {
+    if(spare_threads.fetch_sub(1) > 0)
+    {
+      return true;
+    }
+    spare_threads.fetch_add(1);
+    return false;
+  }
+
+  // Append the nodes of a subtree built on its own, shifting its child
+  // references past the nodes already there (and its leaves by index_base,
+  // if it has indices of its own)
+  void splice(
+    const std::vector<BVH::Node> & subtree,
+    const BVH::BuildStats & subtree_stats,
+    std::vector<BVH::Node> & nodes,
+    BVH::BuildStats & stats,
+    const int index_base = 0)
+  {
+    const int base = nodes.size();
+    for(BVH::Node node : subtree)
+    {
+      node.offset += node.count == 0 ? base : index_base;
+      nodes.push_back(node);
+    }
+    stats.num_leaves += subtree_stats.num_leaves;
+    stats.max_depth = std::max(stats.max_depth,subtree_stats.max_depth);
+  }
+
+  // Build both children of the node just appended to nodes, over
+  // indices[begin,mid) and indices[mid,end). A large first child goes to a
+  // spare thread (if any) while this one builds the second, and both are
+  // spliced in afterwards, in the same depth-first order a single thread
+  // would produce.
+  //
+  // Inputs:
+  //   builder  builder with a method `int build(int begin, int end, int
+  //     depth, std::vector<BVH::Node> & nodes, BVH::BuildStats & stats)`
+  //     appending a subtree to nodes and returning the index of its root
+  // Returns index of second child in nodes
+  template <typename Builder>
+  int build_children(
+    Builder & builder,
+    const int begin,
+    const int mid,
+    const int end,
+    const int depth,
+    std::vector<BVH::Node> & nodes,
+    BVH::BuildStats & stats)
+  {
+    if(end - begin < PARALLEL_MIN_SIZE ||
+      !take_thread(builder.spare_threads))
+    {
+      builder.build(begin,mid,depth+1,nodes,stats);
+      return builder.build(mid,end,depth+1,nodes,stats);
+    }
+    std::vector<BVH::Node> first;
+    BVH::BuildStats first_stats;
+    std::thread worker([&]()
+    {
+      builder.build(begin,mid,depth+1,first,first_stats);
+      builder.spare_threads.fetch_add(1);
+    });
+    std::vector<BVH::Node> second;
+    BVH::BuildStats second_stats;
+    builder.build(mid,end,depth+1,second,second_stats);
+    worker.join();
+    splice(first,first_stats,nodes,stats);
+    const int second_index = nodes.size();
+    splice(second,second_stats,nodes,stats);
+    return second_index;
+  }
+
+  struct SahBuilder
+  {
+    const std::vector<Eigen::AlignedBox3d> & boxes;
+    const std::vector<Eigen::Vector3d> & centroids;
+    const int max_leaf_size;
+    std::vector<int> & indices;
+    std::atomic<int> & spare_threads;
+
+    // Recursively build the subtree over indices[begin,end), appending its
+    // nodes and returning the index of its root node
+    int build(
+      const int begin,
+      const int end,
+      const int depth,
+      std::vector<BVH::Node> & nodes,
+      BVH::BuildStats & stats)
+    {
+      const int node_index = nodes.size();
+      nodes.push_back(BVH::Node());
+      Eigen::AlignedBox3d box;
+      Eigen::AlignedBox3d centroid_box;
+      for(int i = begin;i<end;i++)
+      {
+        box.extend(boxes[indices[i]]);
+        centroid_box.extend(centroids[indices[i]]);
+      }
+      nodes[node_index].box = box;
+      stats.max_depth = std::max(stats.max_depth,depth);
+
+      const int count = end - begin;
+      auto make_leaf = [&]() -> int
+      {
+        nodes[node_index].offset = begin;
+        nodes[node_index].count = count;
+        stats.num_leaves++;
+        return node_index;
+      };
+      if(count <= 1 || depth >= MAX_DEPTH)
+      {
+        return make_leaf();
+      }
+
+      // Evaluate SAH at every bin boundary along every axis
+      const Eigen::Vector3d extent = centroid_box.sizes();
+      const double parent_area = half_area(box);
+      double best_cost = std::numeric_limits<double>::infinity();
+      int best_axis = -1;
+      int best_split = -1;
+      auto bin_of = [&](const int primitive, const int axis) -> int
+      {
+        const int b = static_cast<int>(
+          NUM_BINS *
+          (centroids[primitive](axis) - centroid_box.min()(axis)) /
+          extent(axis));
+        return std::min(std::max(b,0),NUM_BINS-1);
+      };
+      for(int axis = 0;axis<3;axis++)
+      {
+        if(!(extent(axis) > 0))
+        {
+          continue;
+        }
+        Eigen::AlignedBox3d bin_box[NUM_BINS];
+        int bin_count[NUM_BINS] = {0};
+        for(int i = begin;i<end;i++)
+        {
+          const int b = bin_of(indices[i],axis);
+          bin_box[b].extend(boxes[indices[i]]);
+          bin_count[b]++;
+        }
+        // Sweep from the right to get the cost of every right-hand side
+        double right_area[NUM_BINS];
+        int right_count[NUM_BINS];
+        Eigen::AlignedBox3d accum;
+        int accum_count = 0;
+        for(int b = NUM_BINS-1;b>0;b--)
+        {
+          accum.extend(bin_box[b]);
+          accum_count += bin_count[b];
+          right_area[b] = half_area(accum);
+          right_count[b] = accum_count;
+        }
+        accum.setEmpty();
+        accum_count = 0;
+        for(int b = 1;b<NUM_BINS;b++)
+        {
+          accum.extend(bin_box[b-1]);
+          accum_count += bin_count[b-1];
+          if(accum_count == 0 || right_count[b] == 0)
+          {
+            continue;
+          }
+          const double cost = TRAVERSAL_COST + INTERSECTION_COST *
+            (half_area(accum)*accum_count + right_area[b]*right_count[b]) /
+            parent_area;
+          if(cost < best_cost)
+          {
+            best_cost = cost;
+            best_axis = axis;
+            best_split = b;
+          }
+        }
+      }
+
+      int mid;
+      if(best_axis < 0)
+      {
+        // All centroids coincide: no spatial split exists
+        if(count <= max_leaf_size)
+        {
+          return make_leaf();
+        }
+        mid = (begin + end)/2;
+      }else
+      {
+        if(count <= max_leaf_size && best_cost >= INTERSECTION_COST*count)
+        {
+          return make_leaf();
+        }
+        mid = std::partition(
+          indices.begin()+begin,
+          indices.begin()+end,
+          [&](const int primitive)
+          {
+            return bin_of(primitive,best_axis) < best_split;
+          }) - indices.begin();
+      }
+      const int second = build_children(
+        *this,begin,mid,end,depth,nodes,stats);
+      nodes[node_index].offset = second;
+      nodes[node_index].count = 0;
+      return node_index;
+    }
+  };
+
+  // Interleave the low 21 bits of x with two zero bits each
+  std::uint64_t spread_bits(std::uint64_t x)
+  {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+  }
+
+  // Sort primitives along a Morton curve through their centers.
+  //
+  // Inputs:
+  //   boxes  #boxes list of primitive bounding boxes
+  // Outputs:
+  //   indices  #boxes list of primitives in curve order
+  //   codes  #boxes list of Morton codes in curve order
+  void sort_by_morton_code(
+    const std::vector<Eigen::AlignedBox3d> & boxes,
+    std::vector<int> & indices,
+    std::vector<std::uint64_t> & codes)
+  {
+    const int n = boxes.size();
+    Eigen::AlignedBox3d centroid_box;
+    for(int i = 0;i<n;i++)
+    {
+      centroid_box.extend(boxes[i].center());
+    }
+    const double cells = 1 << MORTON_BITS;
+    const Eigen::Vector3d extent = centroid_box.sizes();
+    std::vector<std::uint64_t> unsorted_codes(n);
+    for(int i = 0;i<n;i++)
+    {
+      std::uint64_t code = 0;
+      for(int a = 0;a<3;a++)
+      {
+        // Flat axes (and NaNs) map to cell 0
+        const double t = extent(a) > 0 ?
+          (boxes[i].center()(a) - centroid_box.min()(a)) / extent(a) : 0;
+        const std::uint64_t cell = t > 0 ?
+          static_cast<std::uint64_t>(std::min(t*cells,cells-1)) : 0;
+        code |= spread_bits(cell) << (2-a);
+      }
+      unsorted_codes[i] = code;
+    }
+
+    // Least significant digit radix sort: stable, so equal codes stay in
+    // primitive order
+    const int DIGIT_BITS = 11;
+    const int NUM_DIGITS = 1 << DIGIT_BITS;
+    std::vector<int> order(n);
+    std::vector<int> scratch(n);
+    for(int i = 0;i<n;i++)
+    {
+      order[i] = i;
+    }
+    for(int shift = 0;shift<3*MORTON_BITS;shift += DIGIT_BITS)
+    {
+      std::vector<int> start(NUM_DIGITS+1,0);
+      for(int i = 0;i<n;i++)
+      {
+        start[((unsorted_codes[i] >> shift) & (NUM_DIGITS-1)) + 1]++;
+      }
+      for(int d = 0;d<NUM_DIGITS;d++)
+      {
+        start[d+1] += start[d];
+      }
+      for(const int i : order)
+      {
+        scratch[start[(unsorted_codes[i] >> shift) & (NUM_DIGITS-1)]++] = i;
+      }
+      order.swap(scratch);
+    }
+    indices = order;
+    codes.resize(n);
+    for(int i = 0;i<n;i++)
+    {
+      codes[i] = unsorted_codes[order[i]];
+    }
+  }
+
+  struct MortonBuilder
+  {
+    const std::vector<Eigen::AlignedBox3d> & boxes;
+    // Morton code of the primitive in each position of indices (sorted)
+    const std::vector<std::uint64_t> & codes;
+    const int max_leaf_size;
+    const std::vector<int> & indices;
+    std::atomic<int> & spare_threads;
+
+    // Recursively build the subtree over indices[begin,end), appending its
+    // nodes and returning the index of its root node
+    int build(
+      const int begin,
+      const int end,
+      const int depth,
+      std::vector<BVH::Node> & nodes,
+      BVH::BuildStats & stats)
+    {
+      const int node_index = nodes.size();
+      nodes.push_back(BVH::Node());
+      stats.max_depth = std::max(stats.max_depth,depth);
+      const int count = end - begin;
+      if(count <= max_leaf_size || depth >= MAX_DEPTH)
+      {
+        BVH::Node & leaf = nodes[node_index];
+        for(int i = begin;i<end;i++)
+        {
+          leaf.box.extend(boxes[indices[i]]);
+        }
+        leaf.offset = begin;
+        leaf.count = count;
+        stats.num_leaves++;
+        return node_index;
+      }
+
+      int mid = (begin + end)/2;
+      const std::uint64_t differ = codes[begin] ^ codes[end-1];
+      if(differ != 0)
+      {
+        // The codes of the range share every bit above the highest one in
+        // which its ends differ, so that bit splits it in two
+        std::uint64_t bit = std::uint64_t(1) << 62;
+        while(!(differ & bit))
+        {
+          bit >>= 1;
+        }
+        mid = std::partition_point(
+          codes.begin()+begin,
+          codes.begin()+end,
+          [bit](const std::uint64_t code) { return !(code & bit); }) -
+          codes.begin();
+      }
+      const int second = build_children(
+        *this,begin,mid,end,depth,nodes,stats);
+      // Boxes are gathered on the way up
+      nodes[node_index].box = nodes[node_index+1].box.merged(nodes[second].box);
+      nodes[node_index].offset = second;
+      nodes[node_index].count = 0;
+      return node_index;
+    }
+  };
+
+  // Primitive, or the part of it within box, during a spatial split build
+  struct Reference
+  {
+    int primitive;
+    Eigen::AlignedBox3d box;
+  };
+
+  // Binned SAH over references, also considering splits of space at bin
+  // boundaries (Stich et al., "Spatial Splits in Bounding Volume
+  // Hierarchies", 2009). Each subtree may add a budget of references, shared
+  // between its children in proportion to their sizes, so that the tree does
+  // not depend on which thread builds what.
+  struct SpatialBuilder
+  {
+    const std::vector<Eigen::AlignedBox3d> & boxes;
+    const BVH::SplitFunction & split;
+    const int max_leaf_size;
+    // Overlap (half area) of object split children above which spatial
+    // splits are tried
+    const double min_overlap;
+    std::atomic<int> & spare_threads;
+
+    // Parts of a reference on either side of a plane (empty if none)
+    void split_reference(
+      const Reference & reference,
+      const int axis,
+      const double position,
+      Reference & left,
+      Reference & right) const
+    {
+      Eigen::AlignedBox3d left_box, right_box;
+      if(split)
+      {
+        split(reference.primitive,axis,position,left_box,right_box);
+      }else
+      {
+        left_box = right_box = boxes[reference.primitive];
+        left_box.max()(axis) = std::min(left_box.max()(axis),position);
+        right_box.min()(axis) = std::max(right_box.min()(axis),position);
+      }
+      left = Reference{
+        reference.primitive,left_box.intersection(reference.box)};
+      right = Reference{
+        reference.primitive,right_box.intersection(reference.box)};
+    }
+
+    // Recursively build the subtree over references, appending its nodes
+    // and leaf entries and returning the index of its root node.
+    //
+    // Inputs:
+    //   references  references to build over (emptied)
+    //   budget  number of references splits may add
+    int build(
+      std::vector<Reference> & references,
+      const int budget,
+      const int depth,
+      std::vector<BVH::Node> & nodes,
+      std::vector<int> & indices,
+      BVH::BuildStats & stats)
+    {
+      const int node_index = nodes.size();
+      nodes.push_back(BVH::Node());
+      Eigen::AlignedBox3d box;
+      Eigen::AlignedBox3d centroid_box;
+      for(const Reference & reference : references)
+      {
+        box.extend(reference.box);
+        centroid_box.extend(reference.box.center());
+      }
+      nodes[node_index].box = box;
+      stats.max_depth = std::max(stats.max_depth,depth);
+
+      const int count = references.size();
+      auto make_leaf = [&]() -> int
+      {
+        nodes[node_index].offset = indices.size();
+        nodes[node_index].count = count;
+        for(const Reference & reference : references)
+        {
+          indices.push_back(reference.primitive);
+        }
+        references.clear();
+        stats.num_leaves++;
+        return node_index;
+      };
+      if(count <= 1 || depth >= MAX_DEPTH)
+      {
+        return make_leaf();
+      }
+      const double parent_area = half_area(box);
+
+      // Object split, as in SahBuilder
+      const Eigen::Vector3d extent = centroid_box.sizes();
+      double object_cost = std::numeric_limits<double>::infinity();
+      int object_axis = -1;
+      int object_split = -1;
+      Eigen::AlignedBox3d object_left, object_right;
+      auto bin_of = [&](const Reference & reference, const int axis) -> int
+      {
+        const int b = static_cast<int>(
+          NUM_BINS *
+          (reference.box.center()(axis) - centroid_box.min()(axis)) /
+          extent(axis));
+        return std::min(std::max(b,0),NUM_BINS-1);
+      };
+      for(int axis = 0;axis<3;axis++)
+      {
+        if(!(extent(axis) > 0))
+        {
+          continue;
+        }
+        Eigen::AlignedBox3d bin_box[NUM_BINS];
+        int bin_count[NUM_BINS] = {0};
+        for(const Reference & reference : references)
+        {
+          const int b = bin_of(reference,axis);
+          bin_box[b].extend(reference.box);
+          bin_count[b]++;
+        }
+        Eigen::AlignedBox3d right_box[NUM_BINS];
+        int right_count[NUM_BINS];
+        Eigen::AlignedBox3d accum;
+        int accum_count = 0;
+        for(int b = NUM_BINS-1;b>0;b--)
+        {
+          accum.extend(bin_box[b]);
+          accum_count += bin_count[b];
+          right_box[b] = accum;
+          right_count[b] = accum_count;
+        }
+        accum.setEmpty();
+        accum_count = 0;
+        for(int b = 1;b<NUM_BINS;b++)
+        {
+          accum.extend(bin_box[b-1]);
+          accum_count += bin_count[b-1];
+          if(accum_count == 0 || right_count[b] == 0)
+          {
+            continue;
+          }
+          const double cost = TRAVERSAL_COST + INTERSECTION_COST *
+            (half_area(accum)*accum_count +
+              half_area(right_box[b])*right_count[b]) / parent_area;
+          if(cost < object_cost)
+          {
+            object_cost = cost;
+            object_axis = axis;
+            object_split = b;
+            object_left = accum;
+            object_right = right_box[b];
+          }
+        }
+      }
+
+      // Spatial split at the boundaries of equal bins across the node,
+      // where the object split leaves children overlapping
+      double spatial_cost = std::numeric_limits<double>::infinity();
+      int spatial_axis = -1;
+      double spatial_position = 0;
+      if(budget > 0 && (object_axis < 0 ||
+        half_area(object_left.intersection(object_right)) > min_overlap))
+      {
+        for(int axis = 0;axis<3;axis++)
+        {
+          const double lo = box.min()(axis);
+          const double width = box.max()(axis) - lo;
+          if(!(width > 0))
+          {
+            continue;
+          }
+          auto plane = [&](const int b) -> double
+          {
+            return lo + width*b/NUM_BINS;
+          };
+          auto spatial_bin = [&](const double x) -> int
+          {
+            const int b = static_cast<int>(NUM_BINS*(x - lo)/width);
+            return std::min(std::max(b,0),NUM_BINS-1);
+          };
+          Eigen::AlignedBox3d bin_box[NUM_BINS];
+          int entries[NUM_BINS] = {0};
+          int exits[NUM_BINS] = {0};
+          for(const Reference & reference : references)
+          {
+            const int first = spatial_bin(reference.box.min()(axis));
+            const int last = spatial_bin(reference.box.max()(axis));
+            // Chop the reference into the bins it spans
+            Reference rest = reference;
+            for(int b = first;b<last;b++)
+            {
+              Reference left, right;
+              split_reference(rest,axis,plane(b+1),left,right);
+              bin_box[b].extend(left.box);
+              rest = right;
+            }
+            bin_box[last].extend(rest.box);
+            entries[first]++;
+            exits[last]++;
+          }
+          double right_area[NUM_BINS];
+          int right_count[NUM_BINS];
+          Eigen::AlignedBox3d accum;
+          int accum_count = 0;
+          for(int b = NUM_BINS-1;b>0;b--)
+          {
+            accum.extend(bin_box[b]);
+            accum_count += exits[b];
+            right_area[b] = half_area(accum);
+            right_count[b] = accum_count;
+          }
+          accum.setEmpty();
+          accum_count = 0;
+          for(int b = 1;b<NUM_BINS;b++)
+          {
+            accum.extend(bin_box[b-1]);
+            accum_count += entries[b-1];
+            if(accum_count == 0 || right_count[b] == 0 ||
+              accum_count + right_count[b] - count > budget)
+            {
+              continue;
+            }
+            const double cost = TRAVERSAL_COST + INTERSECTION_COST *
+              (half_area(accum)*accum_count + right_area[b]*right_count[b]) /
+              parent_area;
+            if(cost < spatial_cost)
+            {
+              spatial_cost = cost;
+              spatial_axis = axis;
+              spatial_position = plane(b);
+            }
+          }
+        }
+      }
+
+      const double best_cost = std::min(object_cost,spatial_cost);
+      if(count <= max_leaf_size &&
+        (best_cost >= INTERSECTION_COST*count ||
+          (object_axis < 0 && spatial_axis < 0)))
+      {
+        return make_leaf();
+      }
+      std::vector<Reference> left, right;
+      if(spatial_cost < object_cost)
+      {
+        partition_spatial(references,spatial_axis,spatial_position,left,right);
+      }
+      if(left.empty() || right.empty())
+      {
+        left.clear();
+        right.clear();
+        if(object_axis >= 0)
+        {
+          for(const Reference & reference : references)
+          {
+            (bin_of(reference,object_axis) < object_split ?
+              left : right).push_back(reference);
+          }
+        }else
+        {
+          // No split separates anything: halve the references
+          left.assign(references.begin(),references.begin() + count/2);
+          right.assign(references.begin() + count/2,references.end());
+        }
+      }
+      references.clear();
+      references.shrink_to_fit();
+
+      // Share what is left of the budget
+      const int total = left.size() + right.size();
+      const int remaining = std::max(budget - (total - count),0);
+      const int left_budget = (std::int64_t)remaining*left.size()/total;
+      const int second = build_children(
+        left,left_budget,right,remaining - left_budget,depth,
+        nodes,indices,stats);
+      nodes[node_index].offset = second;
+      nodes[node_index].count = 0;
+      return node_index;
+    }
+
+    // Split references by a plane. References straddling it are split in
+    // two, unless keeping them whole on one side is cheaper by SAH
+    // ("reference unsplitting").
+    void partition_spatial(
+      const std::vector<Reference> & references,
+      const int axis,
+      const double position,
+      std::vector<Reference> & left,
+      std::vector<Reference> & right) const
+    {
+      Eigen::AlignedBox3d left_box, right_box;
+      std::vector<const Reference *> straddling;
+      for(const Reference & reference : references)
+      {
+        if(reference.box.max()(axis) <= position)
+        {
+          left.push_back(reference);
+          left_box.extend(reference.box);
+        }else if(reference.box.min()(axis) >= position)
+        {
+          right.push_back(reference);
+          right_box.extend(reference.box);
+        }else
+        {
+          straddling.push_back(&reference);
+        }
+      }
+      for(const Reference * reference : straddling)
+      {
+        Reference left_part, right_part;
+        split_reference(*reference,axis,position,left_part,right_part);
+        const double n_left = left.size();
+        const double n_right = right.size();
+        const double split_cost =
+          half_area(left_box.merged(left_part.box))*(n_left+1) +
+          half_area(right_box.merged(right_part.box))*(n_right+1);
+        const double left_cost =
+          half_area(left_box.merged(reference->box))*(n_left+1) +
+          half_area(right_box)*n_right;
+        const double right_cost =
+          half_area(left_box)*n_left +
+          half_area(right_box.merged(reference->box))*(n_right+1);
+        if(right_part.box.isEmpty() ||
+          (!left_part.box.isEmpty() && left_cost <= split_cost &&
+            left_cost <= right_cost))
+        {
+          left.push_back(*reference);
+          left_box.extend(reference->box);
+        }else if(left_part.box.isEmpty() || right_cost <= split_cost)
+        {
+          right.push_back(*reference);
+          right_box.extend(reference->box);
+        }else
+        {
+          left.push_back(left_part);
+          left_box.extend(left_part.box);
+          right.push_back(right_part);
+          right_box.extend(right_part.box);
+        }
+      }
+    }
+
+    // Build both children, the first on a spare thread (if any) when large,
+    // and splice them in depth-first order (see build_children above).
+    // Returns index of second child in nodes
+    int build_children(
+      std::vector<Reference> & left,
+      const int left_budget,
+      std::vector<Reference> & right,
+      const int right_budget,
+      const int depth,
+      std::vector<BVH::Node> & nodes,
+      std::vector<int> & indices,
+      BVH::BuildStats & stats)
+    {
+      if(left.size() + right.size() < (std::size_t)PARALLEL_MIN_SIZE ||
+        !take_thread(spare_threads))
+      {
+        build(left,left_budget,depth+1,nodes,indices,stats);
+        return build(right,right_budget,depth+1,nodes,indices,stats);
+      }
+      std::vector<BVH::Node> first_nodes;
+      std::vector<int> first_indices;
+      BVH::BuildStats first_stats;
+      std::thread worker([&]()
+      {
+        build(left,left_budget,depth+1,first_nodes,first_indices,first_stats);
+        spare_threads.fetch_add(1);
+      });
+      std::vector<BVH::Node> second_nodes;
+      std::vector<int> second_indices;
+      BVH::BuildStats second_stats;
+      build(
+        right,right_budget,depth+1,second_nodes,second_indices,second_stats);
+      worker.join();
+      splice(first_nodes,first_stats,nodes,stats,indices.size());
+      indices.insert(indices.end(),first_indices.begin(),first_indices.end());
+      const int second_index = nodes.size();
+      splice(second_nodes,second_stats,nodes,stats,indices.size());
+      indices.insert(
+        indices.end(),second_indices.begin(),second_indices.end());
+      return second_index;
+    }
+  };
+}
+
+const int BVH::COMPRESSED_WIDTH;
+
+namespace
+{
+  // Width that build and read collapse to
+  std::atomic<int> the_default_width(8);
+
+  // Copy a binary node's box into a slot of the wide tree
+  void set_slot_box(
+    const Eigen::AlignedBox3d & box,
+    const int slot,
+    BVH::WideNodes & wide)
+  {
+    const int width = wide.width;
+    double * bounds =
+      wide.bounds.data() + 6*width*(slot/width) + slot%width;
+    for(int a = 0;a<3;a++)
+    {
+      bounds[a*width] = box.min()(a);
+      bounds[(3+a)*width] = box.max()(a);
+    }
+  }
+
+  // Fill in wide node `wide_index` as the collapse of binary node
+  // `node_index` and recurse into its inner children (in preorder)
+  void collapse_node(
+    const std::vector<BVH::Node> & nodes,
+    const int node_index,
+    const int wide_index,
+    BVH::WideNodes & wide)
+  {
+    const int width = wide.width;
+    // Open the inner child with the largest surface area until the node is
+    // full (or only leaves are left); children stay in binary tree order
+    std::vector<int> children;
+    const BVH::Node & node = nodes[node_index];
+    if(node.count > 0)
+    {
+      children = {node_index};
+    }else
+    {
+      children = {node_index+1,node.offset};
+    }
+    while((int)children.size() < width)
+    {
+      int best = -1;
+      double best_area = -1;
+      for(int c = 0;c<(int)children.size();c++)
+      {
+        const BVH::Node & child = nodes[children[c]];
+        if(child.count == 0 && half_area(child.box) > best_area)
+        {
+          best = c;
+          best_area = half_area(child.box);
+        }
+      }
+      if(best < 0)
+      {
+        break;
+      }
+      const int opened = children[best];
+      children[best] = nodes[opened].offset;
+      children.insert(children.begin()+best,opened+1);
+    }
+
+    wide.sizes[wide_index] = children.size();
+    for(int c = 0;c<(int)children.size();c++)
+    {
+      const int slot = wide_index*width + c;
+      const BVH::Node & child = nodes[children[c]];
+      set_slot_box(child.box,slot,wide);
+      wide.sources[slot] = children[c];
+      wide.counts[slot] = child.count;
+      if(child.count > 0)
+      {
+        wide.children[slot] = child.offset;
+      }else
+      {
+        wide.children[slot] = wide.sizes.size();
+        wide.sizes.push_back(0);
+        wide.bounds.resize(wide.bounds.size() + 6*width);
+        wide.children.resize(wide.children.size() + width,0);
+        wide.counts.resize(wide.counts.size() + width,0);
+        wide.sources.resize(wide.sources.size() + width,-1);
+        collapse_node(nodes,children[c],wide.children[slot],wide);
+      }
+    }
+  }
+
+  // Collapse a non-empty binary tree into wide nodes of `width` children
+  void collapse_tree(
+    const std::vector<BVH::Node> & nodes,
+    const int width,
+    BVH::WideNodes & wide)
+  {
+    wide = BVH::WideNodes();
+    wide.width = width;
+    wide.sizes.push_back(0);
+    wide.bounds.resize(6*width);
+    wide.children.resize(width,0);
+    wide.counts.resize(width,0);
+    wide.sources.resize(width,-1);
+    collapse_node(nodes,0,0,wide);
+    // Full vector loads past the last node stay in bounds
+    wide.bounds.resize(wide.bounds.size() + SIMD_MAX_LANES,0);
+    for(std::vector<int> * v :
+      {&wide.children,&wide.counts,&wide.sizes,&wide.sources})
+    {
+      v->shrink_to_fit();
+    }
+    wide.bounds.shrink_to_fit();
+  }
+
+  // Quantize the child boxes of one wide node relative to their union.
+  // Byte q stands for origin + q*scale, evaluated in double exactly like the
+  // traversal kernels do; mins are rounded down and maxes up.
+  //
+  // Returns false if the boxes can't be represented (not finite in float)
+  bool compress_node(
+    const BVH::WideNodes & wide,
+    const int node,
+    BVH::CompressedNode & compressed)
+  {
+    const int width = wide.width;
+    const int size = wide.sizes[node];
+    const double * bounds = wide.bounds.data() + 6*width*node;
+    compressed = BVH::CompressedNode();
+    compressed.size = size;
+    for(int a = 0;a<3;a++)
+    {
+      double lo = std::numeric_limits<double>::infinity();
+      double hi = -std::numeric_limits<double>::infinity();
+      for(int c = 0;c<size;c++)
+      {
+        lo = std::min(lo,bounds[a*width+c]);
+        hi = std::max(hi,bounds[(3+a)*width+c]);
+      }
+      float origin = lo;
+      while(origin > lo)
+      {
+        origin = std::nextafter(origin,-std::numeric_limits<float>::max());
+      }
+      int exponent;
+      std::frexp((hi - origin)/255,&exponent);
+      float scale = std::ldexp(1.0f,
+        std::max(exponent,std::numeric_limits<float>::min_exponent));
+      while(origin + 255*(double)scale < hi && std::isfinite(scale))
+      {
+        scale *= 2;
+      }
+      if(!std::isfinite(origin) || !std::isfinite(scale) || !(lo <= hi))
+      {
+        return false;
+      }
+      compressed.origin[a] = origin;
+      compressed.scale[a] = scale;
+      const auto dequantize = [&](const int q) -> double
+      {
+        return origin + q*(double)scale;
+      };
+      for(int c = 0;c<size;c++)
+      {
+        const double child_lo = bounds[a*width+c];
+        const double child_hi = bounds[(3+a)*width+c];
+        int q_lo = std::min(std::max(
+          std::floor((child_lo - origin)/scale),0.0),255.0);
+        while(q_lo > 0 && dequantize(q_lo) > child_lo)
+        {
+          q_lo--;
+        }
+        int q_hi = std::min(std::max(
+          std::ceil((child_hi - origin)/scale),0.0),255.0);
+        while(q_hi < 255 && dequantize(q_hi) < child_hi)
+        {
+          q_hi++;
+        }
+        compressed.bounds[a][c] = q_lo;
+        compressed.bounds[3+a][c] = q_hi;
+      }
+    }
+    for(int c = 0;c<size;c++)
+    {
+      const int count = wide.counts[node*width+c];
+      if(count > 255)
+      {
+        return false;
+      }
+      compressed.children[c] = wide.children[node*width+c];
+      compressed.counts[c] = count;
+    }
+    return true;
+  }
+
+  // Quantize a compressed node again from the exact boxes of the binary
+  // nodes its children were collapsed from
+  //
+  // Returns false if the boxes can't be represented (see compress_node)
+  bool requantize_node(
+    const std::vector<BVH::Node> & nodes,
+    const int * sources,
+    BVH::CompressedNode & compressed)
+  {
+    const int width = BVH::COMPRESSED_WIDTH;
+    BVH::WideNodes wide;
+    wide.width = width;
+    wide.sizes.push_back(compressed.size);
+    wide.bounds.resize(6*width);
+    wide.children.resize(width,0);
+    wide.counts.resize(width,0);
+    for(int c = 0;c<compressed.size;c++)
+    {
+      set_slot_box(nodes[sources[c]].box,c,wide);
+      wide.children[c] = compressed.children[c];
+      wide.counts[c] = compressed.counts[c];
+    }
+    return compress_node(wide,0,compressed);
+  }
+}
+
+BVH::BVH(const BVH & other):
+  nodes(other.nodes),
+  indices(other.indices),
+  build_stats(other.build_stats),
+  wide(other.wide),
+  compressed(other.compressed),
+  compressed_sources(other.compressed_sources),
+  weighted_area(other.weighted_area),
+  parents(other.parents),
+  leaves(other.leaves),
+  wide_slots(other.wide_slots)
+{
+}
+
+BVH & BVH::operator=(const BVH & other)
+{
+  nodes = other.nodes;
+  indices = other.indices;
+  build_stats = other.build_stats;
+  wide = other.wide;
+  compressed = other.compressed;
+  compressed_sources = other.compressed_sources;
+  weighted_area = other.weighted_area;
+  parents = other.parents;
+  leaves = other.leaves;
+  wide_slots = other.wide_slots;
+  reset_traversal_stats();
+  return *this;
+}
+
+void BVH::build(
+  const std::vector<Eigen::AlignedBox3d> & boxes,
+  const int max_leaf_size,
+  const BuildMethod method,
+  const int num_threads,
+  const SplitFunction & split)
+{
+  const auto start = std::chrono::steady_clock::now();
+  nodes.clear();
+  indices.resize(boxes.size());
+  build_stats = BuildStats();
+  build_stats.method = method;
+  build_stats.num_primitives = boxes.size();
+  wide = WideNodes();
+  compressed.clear();
+  compressed_sources.clear();
+  weighted_area = 0;
+  parents.clear();
+  leaves.clear();
+  wide_slots.clear();
+  reset_traversal_stats();
+  if(boxes.empty())
+  {
+    return;
+  }
+
+  std::atomic<int> spare_threads(
+    (num_threads > 0 ?
+      num_threads : std::max<int>(std::thread::hardware_concurrency(),1)) - 1);
+  nodes.reserve(2*boxes.size());
+  if(method == MORTON)
+  {
+    std::vector<std::uint64_t> codes;
+    sort_by_morton_code(boxes,indices,codes);
+    MortonBuilder builder{boxes,codes,max_leaf_size,indices,spare_threads};
+    builder.build(0,boxes.size(),0,nodes,build_stats);
+  }else if(method == SPATIAL_SAH)
+  {
+    std::vector<Reference> references(boxes.size());
+    Eigen::AlignedBox3d root;
+    for(int i = 0;i<(int)boxes.size();i++)
+    {
+      references[i] = Reference{i,boxes[i]};
+      root.extend(boxes[i]);
+    }
+    SpatialBuilder builder{
+      boxes,split,max_leaf_size,SPATIAL_OVERLAP*half_area(root),
+      spare_threads};
+    indices.clear();
+    builder.build(
+      references,SPATIAL_BUDGET*boxes.size(),0,nodes,indices,build_stats);
+    indices.shrink_to_fit();
+  }else
+  {
+    std::vector<Eigen::Vector3d> centroids(boxes.size());
+    for(int i = 0;i<(int)boxes.size();i++)
+    {
+      indices[i] = i;
+      centroids[i] = boxes[i].center();
+    }
+    SahBuilder builder{
+      boxes,centroids,max_leaf_size,indices,spare_threads};
+    builder.build(0,boxes.size(),0,nodes,build_stats);
+  }
+  nodes.shrink_to_fit();
+
+  weighted_area = total_weighted_area(nodes);
+  build_stats.sah_cost = sah_cost();
+  build_stats.num_nodes = nodes.size();
+  build_stats.num_references = indices.size();
+  collapse(default_width());
+  build_stats.build_ms = std::chrono::duration<double,std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+bool BVH::refit(
+  const std::vector<Eigen::AlignedBox3d> & boxes,
+  const std::vector<int> & moved)
+{
+  if(parents.size() != nodes.size())
+  {
+    parents.assign(nodes.size(),-1);
+    leaves.assign(indices.size(),-1);
+    for(int n = 0;n<(int)nodes.size();n++)
+    {
+      const Node & node = nodes[n];
+      if(node.count > 0)
+      {
+        for(int i = node.offset;i<node.offset+node.count;i++)
+        {
+          leaves[indices[i]] = n;
+        }
+      }else
+      {
+        parents[n+1] = n;
+        parents[node.offset] = n;
+      }
+    }
+  }
+  const std::vector<int> & sources =
+    compressed.empty() ? wide.sources : compressed_sources;
+  if(wide_slots.size() != nodes.size())
+  {
+    wide_slots.assign(nodes.size(),-1);
+    for(int slot = 0;slot<(int)sources.size();slot++)
+    {
+      if(sources[slot] >= 0)
+      {
+        wide_slots[sources[slot]] = slot;
+      }
+    }
+  }
+  // Compressed nodes holding a changed box
+  std::vector<int> changed;
+  for(const int primitive : moved)
+  {
+    // Walk up until a box comes out unchanged: everything above it is then
+    // unchanged too
+    for(int n = leaves[primitive];n >= 0;n = parents[n])
+    {
+      Node & node = nodes[n];
+      Eigen::AlignedBox3d box;
+      if(node.count > 0)
+      {
+        for(int i = node.offset;i<node.offset+node.count;i++)
+        {
+          box.extend(boxes[indices[i]]);
+        }
+      }else
+      {
+        box.extend(nodes[n+1].box);
+        box.extend(nodes[node.offset].box);
+      }
+      if(box.min() == node.box.min() && box.max() == node.box.max())
+      {
+        break;
+      }
+      weighted_area +=
+        node_cost(node) * (half_area(box) - half_area(node.box));
+      node.box = box;
+      if(wide_slots[n] >= 0 && compressed.empty())
+      {
+        set_slot_box(box,wide_slots[n],wide);
+      }else if(wide_slots[n] >= 0)
+      {
+        changed.push_back(wide_slots[n]/COMPRESSED_WIDTH);
+      }
+    }
+  }
+  // Compressed boxes are relative to the union of their siblings, so a
+  // changed box requantizes its whole node
+  std::sort(changed.begin(),changed.end());
+  changed.erase(std::unique(changed.begin(),changed.end()),changed.end());
+  for(const int c : changed)
+  {
+    if(!requantize_node(
+      nodes,compressed_sources.data() + c*COMPRESSED_WIDTH,compressed[c]))
+    {
+      collapse(default_width());
+      return false;
+    }
+  }
+  return true;
+}
+
+double BVH::sah_cost() const
+{
+  if(nodes.empty())
+  {
+    return 0;
+  }
+  // Expected cost of a random ray hitting the root
+  const double root_area = half_area(nodes[0].box);
+  if(root_area > 0)
+  {
+    return weighted_area / root_area;
+  }
+  double cost = 0;
+  for(const Node & node : nodes)
+  {
+    cost += node_cost(node);
+  }
+  return cost;
+}
+
+void BVH::collapse(const int width)
+{
+  assert(width == 2 || width == 4 || width == 8);
+  wide = WideNodes();
+  wide_slots.clear();
+  compressed.clear();
+  compressed_sources.clear();
+  if(width <= 2 || nodes.empty())
+  {
+    return;
+  }
+  collapse_tree(nodes,width,wide);
+}
+
+bool BVH::compress()
+{
+  if(nodes.empty())
+  {
+    return false;
+  }
+  WideNodes collapsed;
+  collapse_tree(nodes,COMPRESSED_WIDTH,collapsed);
+  std::vector<CompressedNode> result(collapsed.sizes.size());
+  for(int n = 0;n<(int)result.size();n++)
+  {
+    if(!compress_node(collapsed,n,result[n]))
+    {
+      return false;
+    }
+  }
+  compressed.swap(result);
+  compressed_sources.swap(collapsed.sources);
+  wide = WideNodes();
+  wide_slots.clear();
+  return true;
+}
+
+const char * BVH::method_name(const BuildMethod method)
+{
+  switch(method)
+  {
+    case MORTON:
+      return "Morton";
+    case SPATIAL_SAH:
+      return "spatial SAH";
+    default:
+      return "binned SAH";
+  }
+}
+
+int BVH::default_width()
+{
+  return the_default_width;
+}
+
+void BVH::set_default_width(const int width)
+{
+  assert(width == 2 || width == 4 || width == 8);
+  the_default_width = width;
+}
+
+std::atomic<bool> BVH::stats_enabled(false);
+
+void BVH::set_collect_stats(const bool collect)
+{
+  stats_enabled = collect;
+}
+
+std::size_t BVH::memory_size() const
+{
+  return
+    nodes.capacity()*sizeof(Node) +
+    indices.capacity()*sizeof(int) +
+    wide.bounds.capacity()*sizeof(double) +
+    (wide.children.capacity() + wide.counts.capacity() +
+      wide.sizes.capacity() + wide.sources.capacity())*sizeof(int) +
+    compressed.capacity()*sizeof(CompressedNode) +
+    compressed_sources.capacity()*sizeof(int);
+}
+
+std::size_t BVH::traversal_size() const
+{
+  if(!compressed.empty())
+  {
+    return compressed.size()*sizeof(CompressedNode);
+  }
+  if(wide.width > 2)
+  {
+    // Sources are only read by refit
+    return wide.bounds.size()*sizeof(double) +
+      (wide.children.size() + wide.counts.size() + wide.sizes.size())*
+      sizeof(int);
+  }
+  return nodes.size()*sizeof(Node);
+}
+
+void BVH::write(std::string & buffer) const
+{
+  write_binary(buffer,nodes);
+  write_binary(buffer,indices);
+  write_binary(buffer,build_stats);
+}
+
+bool BVH::read(BinaryReader & reader)
+{
+  reset_traversal_stats();
+  bool valid =
+    reader.read(nodes) &&
+    reader.read(indices) &&
+    reader.read(build_stats);
+  // Every child and primitive reference must stay in range, and the tree
+  // must fit the fixed traversal stacks, so that traversal can trust it.
+  // Children always follow their parent, so one forward pass sees every
+  // parent before its children.
+  std::vector<int> depth(nodes.size(),0);
+  for(int n = 0;valid && n<(int)nodes.size();n++)
+  {
+    const Node & node = nodes[n];
+    valid = node.count > 0 ?
+      node.offset >= 0 && node.offset <= (int)indices.size() - node.count :
+      node.count == 0 && n+1 < (int)nodes.size() &&
+        node.offset > n+1 && node.offset < (int)nodes.size() &&
+        depth[n] < MAX_DEPTH;
+    if(valid && node.count == 0)
+    {
+      depth[n+1] = std::max(depth[n+1],depth[n]+1);
+      depth[node.offset] = std::max(depth[node.offset],depth[n]+1);
+    }
+  }
+  for(int i = 0;valid && i<(int)indices.size();i++)
+  {
+    valid = indices[i] >= 0 && indices[i] < (int)indices.size();
+  }
+  if(!valid)
+  {
+    nodes.clear();
+    indices.clear();
+    build_stats = BuildStats();
+  }
+  weighted_area = total_weighted_area(nodes);
+  parents.clear();
+  leaves.clear();
+  collapse(default_width());
+  return valid;
+}
+
+void BVH::reset_traversal_stats() const
+{
+  traversal_stats.rays = 0;
+  traversal_stats.node_visits = 0;
+  traversal_stats.primitive_tests = 0;
+  traversal_stats.packets = 0;
+  traversal_stats.packet_rays = 0;
+  traversal_stats.packet_node_visits = 0;
+  traversal_stats.packet_slots = 0;
+  traversal_stats.packet_active = 0;
+  traversal_stats.packet_fallbacks = 0;
+}
+
+void BVH::print_stats(std::ostream & os) const
+{
+  const double rays = std::max<std::uint64_t>(traversal_stats.rays,1);
+  os<<"  build ("<<method_name(build_stats.method)<<"): "<<
+    build_stats.num_primitives<<" primitives, "<<
+    (build_stats.num_references > build_stats.num_primitives ?
+      std::to_string(build_stats.num_references) + " references, " : "")<<
+    build_stats.num_nodes<<" nodes, "<<
+    build_stats.num_leaves<<" leaves, depth "<<
+    build_stats.max_depth<<", SAH cost "<<
+    build_stats.sah_cost<<", "<<
+    build_stats.build_ms<<" ms"<<std::endl;
+  if(!compressed.empty())
+  {
+    os<<"  compressed: "<<compressed.size()<<" nodes of up to "<<
+      COMPRESSED_WIDTH<<" children, "<<
+      (double)traversal_size()/std::max<int>(indices.size(),1)<<
+      " bytes/primitive"<<std::endl;
+  }else if(wide.width > 2)
+  {
+    os<<"  wide: "<<wide.sizes.size()<<" nodes of up to "<<wide.width<<
+      " children, "<<
+      (double)traversal_size()/std::max<int>(indices.size(),1)<<
+      " bytes/primitive"<<std::endl;
+  }
+  os<<"  traversal: "<<traversal_stats.rays<<" rays, "<<
+    traversal_stats.node_visits/rays<<" nodes/ray, "<<
+    traversal_stats.primitive_tests/rays<<" primitives/ray"<<std::endl;
+  if(traversal_stats.packets > 0)
+  {
+    os<<"  packets: "<<traversal_stats.packets<<" packets of "<<
+      (double)traversal_stats.packet_rays/traversal_stats.packets<<
+      " rays, "<<
+      (double)traversal_stats.packet_node_visits/traversal_stats.packets<<
+      " nodes/packet, "<<
+      100.0*traversal_stats.packet_active/
+        std::max<std::uint64_t>(traversal_stats.packet_slots,1)<<
+      "% utilization, "<<
+      (double)traversal_stats.packet_fallbacks/traversal_stats.packets<<
+      " single ray subtree searches/packet"<<std::endl;
+  }
+}
@@ -0,0 +1,100 @@
+#include "Instance.h"
+#include "Ray.h"
+#include <limits>
+
+Instance::Instance(
+  const std::shared_ptr<const Object> & object,
+  const Eigen::Affine3d & transform):
+  object(object)
+{
+  set_transform(transform);
+}
+
+void Instance::set_transform(const Eigen::Affine3d & transform)
+{
+  to_scene = transform;
+  to_object = transform.inverse();
+  normal_to_scene = to_object.linear().transpose();
+}
+
+Ray Instance::object_ray(const Ray & ray) const
+{
+  Ray local;
+  local.origin = to_object * ray.origin;
+  local.direction = to_object.linear() * ray.direction;
+  return local;
+}
+
+bool Instance::intersect(
+  const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
+{
+  HitRecord record;
+  if(!hit(ray, min_t, std::numeric_limits<double>::infinity(), record))
+  {
+    return false;
+  }
+  t = record.t;
+  n = surface_normal(ray, min_t, record);
+  return true;
+}
+
+bool Instance::hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  HitRecord & record) const
+{
+  return object->hit(object_ray(ray), min_t, max_t, record);
+}
+
+void Instance::hit_packet(
+  const RayPacket & packet,
+  const int first,
+  const int last,
+  const double min_t,
+  double * max_t,
+  HitRecord * records) const
+{
+  // A linear map keeps neighbouring rays neighbours, so the packet is carried
+  // into object space as a whole
+  RayPacket local;
+  local.size = packet.size;
+  for(int r = first;r<last;r++)
+  {
+    local.rays[r] = object_ray(packet.rays[r]);
+  }
+  object->hit_packet(local, first, last, min_t, max_t, records);
+}
+
+Eigen::Vector3d Instance::surface_normal(
+  const Ray & ray, const double min_t, const HitRecord & record) const
+{
+  return (normal_to_scene *
+    object->surface_normal(object_ray(ray), min_t, record)).normalized();
+}
+
+bool Instance::any_hit(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  return object->any_hit(object_ray(ray), min_t, max_t);
+}
+
+bool Instance::bounding_box(Eigen::AlignedBox3d & box) const
+{
+  Eigen::AlignedBox3d object_box;
+  if(!object->bounding_box(object_box))
+  {
+    return false;
+  }
+  box.setEmpty();
+  if(object_box.isEmpty())
+  {
+    return true;
+  }
+  for(int c = 0;c<8;c++)
+  {
+    box.extend(to_scene * object_box.corner(
+      static_cast<Eigen::AlignedBox3d::CornerType>(c)));
+  }
+  return true;
+}
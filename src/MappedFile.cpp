@@ -0,0 +1,82 @@
+#include "MappedFile.h"
+#if defined(WIN32) || defined(_WIN32)
+#  include <fstream>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const std::string & filename)
+{
+  close();
+#if defined(WIN32) || defined(_WIN32)
+  std::ifstream file(filename,std::ios::binary | std::ios::ate);
+  if(!file)
+  {
+    return false;
+  }
+  buffer.resize(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  if(!file.read(buffer.data(),buffer.size()))
+  {
+    buffer.clear();
+    return false;
+  }
+  begin = buffer.data();
+  length = buffer.size();
+  return true;
+#else
+  const int fd = ::open(filename.c_str(),O_RDONLY);
+  if(fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if(fstat(fd,&info) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  length = info.st_size;
+  if(length == 0)
+  {
+    // mmap refuses empty ranges
+    ::close(fd);
+    return true;
+  }
+  void * address = mmap(nullptr,length,PROT_READ,MAP_PRIVATE,fd,0);
+  // The mapping keeps the file alive on its own
+  ::close(fd);
+  if(address == MAP_FAILED)
+  {
+    length = 0;
+    return false;
+  }
+  // Files are read front to back: ask for aggressive read-ahead
+  madvise(address,length,MADV_SEQUENTIAL);
+  begin = static_cast<const char *>(address);
+  mapped = true;
+  return true;
+#endif
+}
+
+void MappedFile::close()
+{
+#if !(defined(WIN32) || defined(_WIN32))
+  if(mapped)
+  {
+    munmap(const_cast<char *>(begin),length);
+  }
+#endif
+  buffer.clear();
+  begin = nullptr;
+  length = 0;
+  mapped = false;
+}
@@ -0,0 +1,185 @@
+#include "MeshCache.h"
+#include "content_hash.h"
+#include "mesh_bvh_file.h"
+#include "read_stl.h"
+#include "weld_vertices.h"
+
+const std::size_t MeshCache::DEFAULT_BUDGET;
+
+std::shared_ptr<const TriangleMesh> MeshCache::load(
+  const std::string & filename,
+  const BVH::BuildMethod method,
+  const bool compress,
+  const int num_threads)
+{
+  std::uint64_t file_hash;
+  if(!file_content_hash(filename,file_hash))
+  {
+    return std::make_shared<const TriangleMesh>();
+  }
+  // The same file built (or compressed) two ways is two meshes
+  const std::uint32_t method_id = method | (compress ? 0x100 : 0);
+  const std::uint64_t hash =
+    content_hash(&method_id,sizeof(method_id),file_hash);
+
+  std::promise<std::shared_ptr<const TriangleMesh> > promise;
+  std::shared_future<std::shared_ptr<const TriangleMesh> > cached;
+  bool files;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    files = use_files;
+    const auto found = entries.find(hash);
+    if(found != entries.end())
+    {
+      counters.hits++;
+      lru.splice(lru.begin(),lru,found->second.use);
+      cached = found->second.mesh;
+    }else
+    {
+      counters.misses++;
+      lru.push_front(hash);
+      entries[hash] = Entry{promise.get_future().share(),0,lru.begin()};
+    }
+  }
+  if(cached.valid())
+  {
+    // Waits if another thread is still loading it
+    return cached.get();
+  }
+
+  // Load outside the lock so that other meshes load concurrently
+  std::shared_ptr<TriangleMesh> mesh(new TriangleMesh());
+  const bool from_file =
+    files && read_mesh_bvh(filename,file_hash,method,*mesh);
+  if(!from_file)
+  {
+    std::vector<Eigen::Vector3d> corners;
+    const bool read = read_stl(filename,corners);
+    // Share the corners of adjacent triangles
+    weld_vertices(corners,mesh->vertices,mesh->faces);
+    mesh->build(method,num_threads);
+    if(files && read)
+    {
+      // Best effort: the mesh's directory may not be writable
+      write_mesh_bvh(filename,file_hash,*mesh);
+    }
+  }
+  // Cheap next to a build: compressed hierarchies are not kept in files
+  if(compress)
+  {
+    mesh->bvh.compress();
+  }
+  mesh->cache_key = hash;
+  promise.set_value(mesh);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if(from_file)
+  {
+    counters.file_loads++;
+  }
+  const auto found = entries.find(hash);
+  if(found != entries.end())
+  {
+    found->second.bytes = mesh->memory_size();
+    counters.bytes += found->second.bytes;
+    evict();
+  }
+  return mesh;
+}
+
+std::shared_ptr<const TriangleMesh> MeshCache::adopt(
+  const std::shared_ptr<const TriangleMesh> & mesh)
+{
+  std::shared_future<std::shared_ptr<const TriangleMesh> > cached;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto found = entries.find(mesh->cache_key);
+    if(found == entries.end())
+    {
+      std::promise<std::shared_ptr<const TriangleMesh> > promise;
+      promise.set_value(mesh);
+      counters.adopted++;
+      lru.push_front(mesh->cache_key);
+      entries[mesh->cache_key] = Entry{
+        promise.get_future().share(),mesh->memory_size(),lru.begin()};
+      counters.bytes += mesh->memory_size();
+      evict();
+      return mesh;
+    }
+    counters.hits++;
+    lru.splice(lru.begin(),lru,found->second.use);
+    cached = found->second.mesh;
+  }
+  // Waits if another thread is still loading it
+  return cached.get();
+}
+
+void MeshCache::set_budget(const std::size_t new_budget)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  budget = new_budget;
+  evict();
+}
+
+void MeshCache::set_use_files(const bool new_use_files)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  use_files = new_use_files;
+}
+
+void MeshCache::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  const std::size_t kept_budget = budget;
+  budget = 0;
+  evict();
+  budget = kept_budget;
+}
+
+MeshCache::Stats MeshCache::stats() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  Stats result = counters;
+  result.meshes = entries.size();
+  return result;
+}
+
+void MeshCache::print_stats(std::ostream & os) const
+{
+  const Stats s = stats();
+  std::size_t current_budget;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current_budget = budget;
+  }
+  os<<"mesh cache: "<<s.meshes<<" meshes, "<<
+    s.bytes/1e6<<" MB of "<<current_budget/1e6<<" MB budget, "<<
+    s.hits<<" hits, "<<s.misses<<" misses ("<<
+    s.file_loads<<" from .bvh files), "<<s.adopted<<" adopted, "<<
+    s.evictions<<" evictions"<<std::endl;
+}
+
+void MeshCache::evict()
+{
+  auto use = lru.end();
+  while(counters.bytes > budget && use != lru.begin())
+  {
+    --use;
+    const auto found = entries.find(*use);
+    // Meshes still loading have no size yet and stay
+    if(found->second.bytes == 0)
+    {
+      continue;
+    }
+    counters.bytes -= found->second.bytes;
+    counters.evictions++;
+    entries.erase(found);
+    use = lru.erase(use);
+  }
+}
+
+MeshCache & mesh_cache()
+{
+  static MeshCache cache;
+  return cache;
+}
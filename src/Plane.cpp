@@ -27,3 +27,36 @@ bool Plane::intersect(
   ////////////////////////////////////////////////////////////////////////////
 }
 
+
+bool Plane::hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  HitRecord & record) const
+{
+  const double denominator = normal.dot(ray.direction);
+  if (denominator == 0)
+    return false;
+  const double t = (normal.dot(point - ray.origin)) / denominator;
+  if (!(t > min_t && t < max_t))
+    return false;
+  record.t = t;
+  record.primitive = -1;
+  return true;
+}
+
+Eigen::Vector3d Plane::surface_normal(
+  const Ray &, const double, const HitRecord &) const
+{
+  return normal / normal.norm();
+}
+
+bool Plane::any_hit(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  const double denominator = normal.dot(ray.direction);
+  if (denominator == 0)
+    return false;
+  const double t = (normal.dot(point - ray.origin)) / denominator;
+  return t > min_t && t <= max_t;
+}
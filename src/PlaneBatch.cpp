@@ -0,0 +1,79 @@
+#include "PlaneBatch.h"
+#include "simd_kernels.h"
+#include <limits>
+
+namespace
+{
+  SimdRay simd_ray(const Ray & ray)
+  {
+    return SimdRay{
+      {ray.origin(0),ray.origin(1),ray.origin(2)},
+      {ray.direction(0),ray.direction(1),ray.direction(2)}};
+  }
+}
+
+void PlaneBatch::clear()
+{
+  num_slots = 0;
+  for(std::vector<double> & coordinates : planes)
+  {
+    coordinates.clear();
+  }
+}
+
+void PlaneBatch::push_back(
+  const Eigen::Vector3d & point, const Eigen::Vector3d & normal)
+{
+  // NaN padding makes the denominator NaN, which never passes a test
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for(int k = 0;k<6;k++)
+  {
+    planes[k].resize(num_slots);
+    planes[k].push_back(k < 3 ? normal(k) : point(k-3));
+    planes[k].resize(num_slots + SIMD_MAX_LANES,nan);
+  }
+  num_slots++;
+}
+
+void PlaneBatch::set(
+  const int slot,
+  const Eigen::Vector3d & point,
+  const Eigen::Vector3d & normal)
+{
+  for(int k = 0;k<6;k++)
+  {
+    planes[k][slot] = k < 3 ? normal(k) : point(k-3);
+  }
+}
+
+int PlaneBatch::closest_hit(
+  const Ray & ray,
+  const double min_t,
+  const int begin,
+  const int end,
+  double & max_t) const
+{
+  const double * arrays[6];
+  for(int k = 0;k<6;k++)
+  {
+    arrays[k] = planes[k].data();
+  }
+  return simd_kernels().plane_closest_hit(
+    simd_ray(ray),min_t,arrays,begin,end,&max_t);
+}
+
+bool PlaneBatch::any_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  const int begin,
+  const int end) const
+{
+  const double * arrays[6];
+  for(int k = 0;k<6;k++)
+  {
+    arrays[k] = planes[k].data();
+  }
+  return simd_kernels().plane_any_hit(
+    simd_ray(ray),min_t,max_t,arrays,begin,end);
+}
@@ -0,0 +1,237 @@
+#include "Scene.h"
+#include "Plane.h"
+#include "Sphere.h"
+#include "Triangle.h"
+#include <algorithm>
+#include <chrono>
+#include <typeinfo>
+
+namespace
+{
+  // Kinds of objects. The bounded ones come first, in their order within a
+  // BVH leaf.
+  enum ObjectKind
+  {
+    SPHERE = 0,
+    TRIANGLE = 1,
+    OTHER = 2,
+    PLANE = 3,
+    UNBOUNDED = 4
+  };
+  // Spheres and triangles are tested several at a time, so allow somewhat
+  // larger leaves
+  const int MAX_LEAF_SIZE = 8;
+  // Refitting keeps the tree until its SAH cost grows by this factor over
+  // the cost right after the last build
+  const double REBUILD_RATIO = 1.5;
+
+  // Inputs:
+  //   object  object to classify
+  // Outputs:
+  //   box  bounding box of object (if bounded)
+  // Returns kind of object
+  int kind_of(const Object & object, Eigen::AlignedBox3d & box)
+  {
+    // Only batch exact types: a subclass may override intersect
+    if(object.bounding_box(box))
+    {
+      return typeid(object) == typeid(Sphere) ? SPHERE :
+        (typeid(object) == typeid(Triangle) ? TRIANGLE : OTHER);
+    }
+    return typeid(object) == typeid(Plane) ? PLANE : UNBOUNDED;
+  }
+
+  // Copy a bounded object into its entry of the batch of its type (only
+  // plain spheres and triangles have batch data), appending it if index is
+  // one past the end of the batch
+  void store(
+    const Object & object,
+    const int kind,
+    const int index,
+    SphereBatch & spheres,
+    TriangleBatch & triangles)
+  {
+    if(kind == SPHERE)
+    {
+      const Sphere & sphere = static_cast<const Sphere &>(object);
+      if(index == spheres.size())
+      {
+        spheres.push_back(sphere.center,sphere.radius);
+      }else
+      {
+        spheres.set(index,sphere.center,sphere.radius);
+      }
+    }else if(kind == TRIANGLE)
+    {
+      const Triangle & triangle = static_cast<const Triangle &>(object);
+      const Eigen::Vector3d & a = std::get<0>(triangle.corners);
+      const Eigen::Vector3d & b = std::get<1>(triangle.corners);
+      const Eigen::Vector3d & c = std::get<2>(triangle.corners);
+      if(index == triangles.size())
+      {
+        triangles.push_back(a,b,c);
+      }else
+      {
+        triangles.set(index,a,b,c);
+      }
+    }
+  }
+}
+
+Scene::Scene(const std::vector<std::shared_ptr<Object> > & objects):
+  objects(objects)
+{
+  build();
+}
+
+void Scene::build()
+{
+  classify();
+  bvh.build(boxes,MAX_LEAF_SIZE);
+  compile();
+}
+
+bool Scene::build(const BVH & prebuilt)
+{
+  classify();
+  if(prebuilt.indices.size() != boxes.size())
+  {
+    bvh.build(boxes,MAX_LEAF_SIZE);
+    compile();
+    return false;
+  }
+  bvh = prebuilt;
+  compile();
+  return true;
+}
+
+Scene::UpdateStats Scene::update(const std::vector<int> & changed)
+{
+  const auto start = std::chrono::steady_clock::now();
+  UpdateStats stats;
+  stats.changed = changed.size();
+  // An object changing kind moves between lists (or between the type
+  // ranges of its leaf), so anything but an in-place change starts over
+  bool reclassify = object_kinds.size() != objects.size();
+  std::vector<int> moved;
+  for(int c = 0;!reclassify && c<(int)changed.size();c++)
+  {
+    const int i = changed[c];
+    const Object & object = *objects[i];
+    Eigen::AlignedBox3d box;
+    const int kind = kind_of(object,box);
+    if(kind != object_kinds[i])
+    {
+      reclassify = true;
+    }else if(kind == PLANE)
+    {
+      const Plane & plane = static_cast<const Plane &>(object);
+      planes.set(object_slots[i],plane.point,plane.normal);
+    }else if(kind != UNBOUNDED)
+    {
+      const int slot = object_slots[i];
+      moved.push_back(bvh.indices[slot]);
+      boxes[moved.back()] = box;
+      store(object,kind,
+        kind == SPHERE ? sphere_offset[slot] : triangle_offset[slot],
+        spheres,triangles);
+    }
+  }
+
+  if(reclassify)
+  {
+    build();
+    stats.rebuilt = true;
+  }else
+  {
+    bvh.refit(boxes,moved);
+    if(bvh.sah_cost() > REBUILD_RATIO*bvh.build_stats.sah_cost)
+    {
+      bvh.build(boxes,MAX_LEAF_SIZE);
+      compile();
+      stats.rebuilt = true;
+    }
+  }
+  stats.sah_cost = bvh.sah_cost();
+  stats.built_sah_cost = bvh.build_stats.sah_cost;
+  stats.update_ms = std::chrono::duration<double,std::milli>(
+    std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+void Scene::classify()
+{
+  bounded.clear();
+  unbounded.clear();
+  planes.clear();
+  plane_objects.clear();
+  boxes.clear();
+  object_slots.assign(objects.size(),-1);
+  object_kinds.resize(objects.size());
+  for(int i = 0;i<(int)objects.size();i++)
+  {
+    const Object & object = *objects[i];
+    Eigen::AlignedBox3d box;
+    object_kinds[i] = kind_of(object,box);
+    if(object_kinds[i] == PLANE)
+    {
+      const Plane & plane = static_cast<const Plane &>(object);
+      object_slots[i] = planes.size();
+      planes.push_back(plane.point,plane.normal);
+      plane_objects.push_back(i);
+    }else if(object_kinds[i] == UNBOUNDED)
+    {
+      unbounded.push_back(i);
+    }else
+    {
+      bounded.push_back(i);
+      boxes.push_back(box);
+    }
+  }
+}
+
+void Scene::compile()
+{
+  // Sort the slots of every leaf by type so that each type is tested by one
+  // tight loop over a contiguous range
+  slot_objects.resize(bvh.indices.size());
+  sphere_end.assign(bvh.indices.size(),0);
+  triangle_end.assign(bvh.indices.size(),0);
+  const auto type_of = [&](const int b) -> int
+  {
+    return object_kinds[bounded[b]];
+  };
+  for(const BVH::Node & node : bvh.nodes)
+  {
+    if(node.count == 0)
+    {
+      continue;
+    }
+    const auto begin = bvh.indices.begin() + node.offset;
+    const auto end = begin + node.count;
+    std::stable_sort(begin,end,
+      [&](const int a, const int b) { return type_of(a) < type_of(b); });
+    const auto triangles_begin = std::find_if(begin,end,
+      [&](const int b) { return type_of(b) != SPHERE; });
+    const auto others_begin = std::find_if(triangles_begin,end,
+      [&](const int b) { return type_of(b) != TRIANGLE; });
+    sphere_end[node.offset] = triangles_begin - bvh.indices.begin();
+    triangle_end[node.offset] = others_begin - bvh.indices.begin();
+  }
+
+  spheres.clear();
+  triangles.clear();
+  sphere_offset.resize(bvh.indices.size());
+  triangle_offset.resize(bvh.indices.size());
+  for(int s = 0;s<(int)bvh.indices.size();s++)
+  {
+    slot_objects[s] = bounded[bvh.indices[s]];
+    object_slots[slot_objects[s]] = s;
+    sphere_offset[s] = spheres.size();
+    triangle_offset[s] = triangles.size();
+    const int kind = type_of(bvh.indices[s]);
+    store(*objects[slot_objects[s]],kind,
+      kind == SPHERE ? sphere_offset[s] : triangle_offset[s],
+      spheres,triangles);
+  }
+}
@@ -1,25 +1,31 @@
 #include "Sphere.h"
 #include "Ray.h"
 
-bool Sphere::intersect(
-  const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
+namespace
 {
-  ////////////////////////////////////////////////////////////////////////////
-  // Replace with your code here:
-  // Equation reference textbook 4.4.1 p77
-  
-  // Ray: origin e, direction d
-  Eigen::Vector3d e = ray.origin;
-  Eigen::Vector3d d = ray.direction;
-  // Sphere: center c, radius r
-  Eigen::Vector3d c = center;
-  double r = radius;
-  
-  // B^2 - 4AC 
-  double discriminant = pow(d.dot(e-c),2) - d.dot(d) * ((e-c).dot(e-c) - pow(r, 2));
-  bool intersect = false;
-
-  if (discriminant >= 0) {
+  // Smallest parametric distance t >= min_t at which ray meets the sphere.
+  // Returns false if there is none.
+  bool nearest_root(
+    const Ray & ray,
+    const Eigen::Vector3d & center,
+    const double radius,
+    const double min_t,
+    double & t)
+  {
+    // Equation reference textbook 4.4.1 p77
+
+    // Ray: origin e, direction d
+    const Eigen::Vector3d & e = ray.origin;
+    const Eigen::Vector3d & d = ray.direction;
+    // Sphere: center c, radius r
+    const Eigen::Vector3d & c = center;
+    double r = radius;
+
+    // B^2 - 4AC 
+    double discriminant = pow(d.dot(e-c),2) - d.dot(d) * ((e-c).dot(e-c) - pow(r, 2));
+    if (discriminant < 0)
+      return false;
+
     // Find the smallest t value (larger than min_t) 
     double t1 = (-d.dot(e-c) + sqrt(discriminant)) / d.dot(d);
     double t2 = (-d.dot(e-c) - sqrt(discriminant)) / d.dot(d);
@@ -30,32 +36,66 @@ bool Sphere::intersect(
     //   t2    > min_t > t1    --> t2
     //   min_t > t1    > t2    --> none
     //   min_t > t2    > t1    --> none
-    if (t1 >= t2 && t2 >= min_t) {
-      intersect = true;
+    if (t1 >= t2 && t2 >= min_t)
       t = t2;
-    }
-    else if (t2 >= t1 && t1 >= min_t) {
-      intersect = true;
+    else if (t2 >= t1 && t1 >= min_t)
       t = t1;
-    } 
-    else if (t1 >= min_t && min_t > t2){
-      intersect = true;
+    else if (t1 >= min_t && min_t > t2)
       t = t1;
-    }
-    else if (t2 >= min_t) {
-      intersect = true;
+    else if (t2 >= min_t)
       t = t2;
-    }
-    else {
-      intersect = false;
-    }
-
-    // Find unit vector n 
-    n = e + t * d - c;
-    n = n / n.norm();
+    else
+      return false;
+    return true;
   }
-  
-  return intersect;
+}
+
+bool Sphere::intersect(
+  const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
+{
+  ////////////////////////////////////////////////////////////////////////////
+  // Replace with your code here:
+  if (!nearest_root(ray, center, radius, min_t, t))
+    return false;
+
+  // Find unit vector n 
+  n = ray.origin + t * ray.direction - center;
+  n = n / n.norm();
+  return true;
   ////////////////////////////////////////////////////////////////////////////
 }
 
+bool Sphere::hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  HitRecord & record) const
+{
+  double t;
+  if (!nearest_root(ray, center, radius, min_t, t) || !(t < max_t))
+    return false;
+  record.t = t;
+  record.primitive = -1;
+  return true;
+}
+
+Eigen::Vector3d Sphere::surface_normal(
+  const Ray & ray, const double, const HitRecord & record) const
+{
+  Eigen::Vector3d n = ray.origin + record.t * ray.direction - center;
+  return n / n.norm();
+}
+
+bool Sphere::any_hit(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  double t;
+  return nearest_root(ray, center, radius, min_t, t) && t <= max_t;
+}
+
+bool Sphere::bounding_box(Eigen::AlignedBox3d & box) const
+{
+  const Eigen::Vector3d r = Eigen::Vector3d::Constant(std::abs(radius));
+  box = Eigen::AlignedBox3d(center - r, center + r);
+  return true;
+}
@@ -0,0 +1,78 @@
+#include "SphereBatch.h"
+#include "simd_kernels.h"
+#include <limits>
+
+namespace
+{
+  SimdRay simd_ray(const Ray & ray)
+  {
+    return SimdRay{
+      {ray.origin(0),ray.origin(1),ray.origin(2)},
+      {ray.direction(0),ray.direction(1),ray.direction(2)}};
+  }
+}
+
+void SphereBatch::clear()
+{
+  num_slots = 0;
+  cx.clear();
+  cy.clear();
+  cz.clear();
+  r.clear();
+}
+
+void SphereBatch::pad()
+{
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  cx.resize(num_slots + SIMD_MAX_LANES - 1,0);
+  cy.resize(num_slots + SIMD_MAX_LANES - 1,0);
+  cz.resize(num_slots + SIMD_MAX_LANES - 1,0);
+  r.resize(num_slots + SIMD_MAX_LANES - 1,nan);
+}
+
+void SphereBatch::push_back(const Eigen::Vector3d & center, const double radius)
+{
+  cx.resize(num_slots);
+  cy.resize(num_slots);
+  cz.resize(num_slots);
+  r.resize(num_slots);
+  cx.push_back(center(0));
+  cy.push_back(center(1));
+  cz.push_back(center(2));
+  r.push_back(radius);
+  num_slots++;
+  pad();
+}
+
+void SphereBatch::set(
+  const int slot, const Eigen::Vector3d & center, const double radius)
+{
+  cx[slot] = center(0);
+  cy[slot] = center(1);
+  cz[slot] = center(2);
+  r[slot] = radius;
+}
+
+int SphereBatch::closest_hit(
+  const Ray & ray,
+  const double min_t,
+  const int begin,
+  const int end,
+  double & max_t) const
+{
+  return simd_kernels().sphere_closest_hit(
+    simd_ray(ray),min_t,cx.data(),cy.data(),cz.data(),r.data(),
+    begin,end,&max_t);
+}
+
+bool SphereBatch::any_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  const int begin,
+  const int end) const
+{
+  return simd_kernels().sphere_any_hit(
+    simd_ray(ray),min_t,max_t,cx.data(),cy.data(),cz.data(),r.data(),
+    begin,end);
+}
@@ -1,62 +1,64 @@
 #include "Triangle.h"
 #include "Ray.h"
+#include "intersect_triangle.h"
 #include <Eigen/Geometry>
-#include <iostream>
-#include <vector>
 
 bool Triangle::intersect(
   const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
 {
   ////////////////////////////////////////////////////////////////////////////
   // Replace with your code here:
-  // Equation reference Möller–Trumbore Intersection Algorithm
-  // https://en.wikipedia.org/wiki/Möller–Trumbore_intersection_algorithm
-
-  // Tolerance error value
-  const double EPSILON = 0.001;
-  // Ray: origin e, direction d
-  Eigen::Vector3d e = ray.origin;
-  Eigen::Vector3d d = ray.direction;
-  // Triangle corners: a, b, c
-  Eigen::Vector3d a = std::get<0>(corners);
-  Eigen::Vector3d b = std::get<1>(corners);
-  Eigen::Vector3d c = std::get<2>(corners);
-  // Triangle lines between corners: ab, ac, bc
-  Eigen::Vector3d ab = a - b;
-  Eigen::Vector3d bc = b - c;
-  Eigen::Vector3d ac = a - c;
-
-  // Find unit vector n 
-  n = ab.cross(bc) / (ab.cross(bc)).norm();
-
-  // Find the smallest t value (larger than min_t)
-  double ta = (n.dot(a) - n.dot(e)) / (n.dot(d));
-  double tb = (n.dot(b) - n.dot(e)) / (n.dot(d));
-  double tc = (n.dot(c) - n.dot(e)) / (n.dot(d));
-  std::vector<double> t_vec {ta, tb, tc};
-  std::sort(t_vec.begin(), t_vec.end()); // smallest -> largest
-  if (t_vec[0] >= min_t)
-    t = t_vec[0];
-  else if (t_vec[1] >= min_t)
-    t = t_vec[1];
-  else if (t_vec[2] >= min_t)
-    t = t_vec[2];
-  else
+  // Watertight ray/triangle test, see intersect_triangle.h
+  HitRecord record;
+  if (!hit(ray, min_t, std::numeric_limits<double>::infinity(), record))
     return false;
+  t = record.t;
+  n = surface_normal(ray, min_t, record);
+  return true;
+  ////////////////////////////////////////////////////////////////////////////
+}
 
-  // verify that intersect p is within the toleranced range
-  Eigen::Vector3d p = e + t * d;
-  // Triangle lines from corner to intersect: ab, ac, bc
-  Eigen::Vector3d ap = a - p;
-  Eigen::Vector3d bp = b - p;
-  Eigen::Vector3d cp = c - p;
-
-  double offset = abs(ap.cross(bp).norm() + ap.cross(cp).norm() + bp.cross(cp).norm()) / ab.cross(bc).norm();
-  if (1 - EPSILON < offset && offset < 1 + EPSILON)
-    return true;
-  else
+bool Triangle::hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  HitRecord & record) const
+{
+  double t, u, v;
+  if (!intersect_triangle(
+    TriangleRay(ray),
+    std::get<0>(corners), std::get<1>(corners), std::get<2>(corners),
+    min_t, t, u, v) || !(t < max_t))
     return false;
-  ////////////////////////////////////////////////////////////////////////////
+  record.t = t;
+  record.primitive = -1;
+  record.u = u;
+  record.v = v;
+  return true;
 }
 
+Eigen::Vector3d Triangle::surface_normal(
+  const Ray &, const double, const HitRecord &) const
+{
+  return face_normal(
+    std::get<0>(corners), std::get<1>(corners), std::get<2>(corners));
+}
 
+bool Triangle::any_hit(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  double t, u, v;
+  return intersect_triangle(
+    TriangleRay(ray),
+    std::get<0>(corners), std::get<1>(corners), std::get<2>(corners),
+    min_t, t, u, v) && t <= max_t;
+}
+
+bool Triangle::bounding_box(Eigen::AlignedBox3d & box) const
+{
+  box.setEmpty();
+  box.extend(std::get<0>(corners));
+  box.extend(std::get<1>(corners));
+  box.extend(std::get<2>(corners));
+  return true;
+}
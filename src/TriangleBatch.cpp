@@ -0,0 +1,88 @@
+#include "TriangleBatch.h"
+#include "simd_kernels.h"
+#include <limits>
+
+namespace
+{
+  SimdTriangleRay simd_ray(const TriangleRay & ray)
+  {
+    return SimdTriangleRay{
+      {ray.origin(0),ray.origin(1),ray.origin(2)},
+      ray.kx,ray.ky,ray.kz,
+      ray.sx,ray.sy,ray.sz};
+  }
+}
+
+void TriangleBatch::clear()
+{
+  num_slots = 0;
+  for(std::vector<double> & coordinates : corners)
+  {
+    coordinates.clear();
+  }
+}
+
+void TriangleBatch::push_back(
+  const Eigen::Vector3d & a,
+  const Eigen::Vector3d & b,
+  const Eigen::Vector3d & c)
+{
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const Eigen::Vector3d * abc[3] = {&a,&b,&c};
+  for(int k = 0;k<9;k++)
+  {
+    // Drop the old padding, append, pad again with NaN corners (which fail
+    // the t test of the kernels)
+    corners[k].resize(num_slots);
+    corners[k].push_back((*abc[k/3])(k%3));
+    corners[k].resize(num_slots + SIMD_MAX_LANES,nan);
+  }
+  num_slots++;
+}
+
+void TriangleBatch::set(
+  const int slot,
+  const Eigen::Vector3d & a,
+  const Eigen::Vector3d & b,
+  const Eigen::Vector3d & c)
+{
+  const Eigen::Vector3d * abc[3] = {&a,&b,&c};
+  for(int k = 0;k<9;k++)
+  {
+    corners[k][slot] = (*abc[k/3])(k%3);
+  }
+}
+
+int TriangleBatch::closest_hit(
+  const TriangleRay & ray,
+  const double min_t,
+  const int begin,
+  const int end,
+  double & max_t,
+  double & u,
+  double & v) const
+{
+  const double * arrays[9];
+  for(int k = 0;k<9;k++)
+  {
+    arrays[k] = corners[k].data();
+  }
+  return simd_kernels().triangle_closest_hit(
+    simd_ray(ray),min_t,arrays,begin,end,&max_t,&u,&v);
+}
+
+bool TriangleBatch::any_hit(
+  const TriangleRay & ray,
+  const double min_t,
+  const double max_t,
+  const int begin,
+  const int end) const
+{
+  const double * arrays[9];
+  for(int k = 0;k<9;k++)
+  {
+    arrays[k] = corners[k].data();
+  }
+  return simd_kernels().triangle_any_hit(
+    simd_ray(ray),min_t,max_t,arrays,begin,end);
+}
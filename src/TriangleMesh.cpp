@@ -0,0 +1,49 @@
+#include "TriangleMesh.h"
+#include "split_triangle.h"
+
+void TriangleMesh::build(
+  const BVH::BuildMethod method, const int num_threads)
+{
+  const int num_faces = num_slots();
+  num_triangles = num_faces;
+  std::vector<Eigen::AlignedBox3d> boxes(num_faces);
+  for(int f = 0;f<num_faces;f++)
+  {
+    boxes[f].extend(vertices[faces[3*f]]);
+    boxes[f].extend(vertices[faces[3*f+1]]);
+    boxes[f].extend(vertices[faces[3*f+2]]);
+  }
+  bvh.build(boxes,4,method,num_threads,
+    [this](
+      const int f,
+      const int axis,
+      const double position,
+      Eigen::AlignedBox3d & left,
+      Eigen::AlignedBox3d & right)
+    {
+      split_triangle(
+        vertices[faces[3*f]],vertices[faces[3*f+1]],vertices[faces[3*f+2]],
+        axis,position,left,right);
+    });
+  // Store faces in slot order: the tree then refers to face s in slot s
+  // (spatial splits may store a face in several slots)
+  const int num_slots = bvh.indices.size();
+  std::vector<std::uint32_t> sorted(3*num_slots);
+  for(int s = 0;s<num_slots;s++)
+  {
+    const int f = bvh.indices[s];
+    sorted[3*s] = faces[3*f];
+    sorted[3*s+1] = faces[3*f+1];
+    sorted[3*s+2] = faces[3*f+2];
+    bvh.indices[s] = s;
+  }
+  faces.swap(sorted);
+}
+
+std::size_t TriangleMesh::memory_size() const
+{
+  return sizeof(TriangleMesh) +
+    vertices.capacity()*sizeof(Eigen::Vector3d) +
+    faces.capacity()*sizeof(std::uint32_t) +
+    bvh.memory_size();
+}
@@ -1,13 +1,327 @@
 #include "TriangleSoup.h"
 #include "Triangle.h"
-#include "first_hit.h"
+#include "intersect_triangle.h"
+#include "simd_kernels.h"
+#include "weld_vertices.h"
+#include <algorithm>
+
+namespace
+{
+  SimdTriangleRay simd_ray(const TriangleRay & ray)
+  {
+    return SimdTriangleRay{
+      {ray.origin(0),ray.origin(1),ray.origin(2)},
+      ray.kx,ray.ky,ray.kz,
+      ray.sx,ray.sy,ray.sz};
+  }
+}
+
+void TriangleSoup::build()
+{
+  mesh.reset();
+  bvh = BVH();
+  std::vector<Eigen::Vector3d> corners;
+  corners.reserve(3*triangles.size());
+  for(const auto & object : triangles)
+  {
+    const Triangle * triangle =
+      dynamic_cast<const Triangle *>(object.get());
+    if(!triangle)
+    {
+      // Some other kind of object: keep going through its virtual
+      // interface
+      std::vector<Eigen::AlignedBox3d> boxes(triangles.size());
+      for(int f = 0;f<(int)triangles.size();f++)
+      {
+        triangles[f]->bounding_box(boxes[f]);
+      }
+      bvh.build(boxes,4,build_method);
+      if(compress_bvh)
+      {
+        bvh.compress();
+      }
+      return;
+    }
+    corners.push_back(std::get<0>(triangle->corners));
+    corners.push_back(std::get<1>(triangle->corners));
+    corners.push_back(std::get<2>(triangle->corners));
+  }
+  if(corners.empty())
+  {
+    return;
+  }
+  std::shared_ptr<TriangleMesh> welded(new TriangleMesh());
+  weld_vertices(corners,welded->vertices,welded->faces);
+  welded->build(build_method);
+  if(compress_bvh)
+  {
+    welded->bvh.compress();
+  }
+  mesh = welded;
+}
+
+int TriangleSoup::size() const
+{
+  return mesh ? mesh->size() : triangles.size();
+}
+
 bool TriangleSoup::intersect(
   const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
 {
   ////////////////////////////////////////////////////////////////////////////
   // Replace with your code here:
   // Find first hit in all triangles within the TriangleSoup
-  int id = -1;
-  return first_hit(ray, min_t, triangles, id, t, n);
+  HitRecord record;
+  if(!hit(ray, min_t, std::numeric_limits<double>::infinity(), record))
+  {
+    return false;
+  }
+  t = record.t;
+  n = surface_normal(ray, min_t, record);
+  return true;
   ////////////////////////////////////////////////////////////////////////////
 }
+
+bool TriangleSoup::hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  HitRecord & record) const
+{
+  double closest_t = max_t;
+  if(mesh)
+  {
+    if(mesh->faces.empty())
+    {
+      return false;
+    }
+    const SimdTriangleRay triangle_ray = simd_ray(TriangleRay(ray));
+    const auto leaf =
+      [&](const int begin, const int end, double & closest_t) -> bool
+      {
+        double u, v;
+        const int f = simd_kernels().indexed_triangle_closest_hit(
+          triangle_ray, min_t, mesh->vertices.data()->data(),
+          mesh->faces.data(), begin, end, &closest_t, &u, &v);
+        if(f < 0)
+        {
+          return false;
+        }
+        record.t = closest_t;
+        record.primitive = f;
+        record.u = u;
+        record.v = v;
+        return true;
+      };
+    if(mesh->bvh.empty())
+    {
+      return leaf(0, mesh->num_slots(), closest_t);
+    }
+    return mesh->bvh.closest_hit_leaves(ray, min_t, closest_t, leaf);
+  }
+
+  HitRecord triangle_record;
+  auto test = [&](const int f, double & closest_t) -> bool
+  {
+    if(triangles[f]->hit(ray, min_t, closest_t, triangle_record))
+    {
+      closest_t = triangle_record.t;
+      record = triangle_record;
+      record.primitive = f;
+      return true;
+    }
+    return false;
+  };
+  if(bvh.empty())
+  {
+    bool found = false;
+    for(int f = 0;f<(int)triangles.size();f++)
+    {
+      found = test(f, closest_t) || found;
+    }
+    return found;
+  }
+  return bvh.closest_hit(ray, min_t, closest_t, test);
+}
+
+void TriangleSoup::hit_packet(
+  const RayPacket & packet,
+  const int first,
+  const int last,
+  const double min_t,
+  double * max_t,
+  HitRecord * records) const
+{
+  if(!mesh || mesh->bvh.empty())
+  {
+    Object::hit_packet(packet, first, last, min_t, max_t, records);
+    return;
+  }
+  // The range becomes a packet of its own
+  RayPacket rays;
+  rays.size = last - first;
+  double * rays_max_t = max_t + first;
+  HitRecord * rays_records = records + first;
+  // Rays set up for triangle tests, one by one and, if they all share an
+  // axis permutation, as a packet
+  SimdTriangleRay triangle_rays[RayPacket::MAX_SIZE];
+  SimdTrianglePacket triangle_packet;
+  bool shared = true;
+  for(int r = 0;r<rays.size;r++)
+  {
+    rays.rays[r] = packet.rays[first+r];
+    const SimdTriangleRay & ray = triangle_rays[r] =
+      simd_ray(TriangleRay(rays.rays[r]));
+    if(r == 0)
+    {
+      triangle_packet.kx = ray.kx;
+      triangle_packet.ky = ray.ky;
+      triangle_packet.kz = ray.kz;
+    }
+    shared = shared && ray.kx == triangle_packet.kx &&
+      ray.ky == triangle_packet.ky && ray.kz == triangle_packet.kz;
+    triangle_packet.ox[r] = ray.origin[ray.kx];
+    triangle_packet.oy[r] = ray.origin[ray.ky];
+    triangle_packet.oz[r] = ray.origin[ray.kz];
+    triangle_packet.sx[r] = ray.sx;
+    triangle_packet.sy[r] = ray.sy;
+    triangle_packet.sz[r] = ray.sz;
+  }
+  for(int r = rays.size;r<rays.size+SIMD_MAX_LANES-1;r++)
+  {
+    triangle_packet.ox[r] = triangle_packet.oy[r] = triangle_packet.oz[r] = 0;
+    triangle_packet.sx[r] = triangle_packet.sy[r] = triangle_packet.sz[r] = 0;
+  }
+
+  const SimdKernels & kernels = simd_kernels();
+  const double * vertices = mesh->vertices.data()->data();
+  const std::uint32_t * faces = mesh->faces.data();
+  const auto leaf = [&](
+    const int begin,
+    const int end,
+    const int first,
+    const int last,
+    double * max_t) -> bool
+    {
+      double u[RayPacket::MAX_SIZE], v[RayPacket::MAX_SIZE];
+      int closest[RayPacket::MAX_SIZE];
+      if(shared && last - first > 1)
+      {
+        std::fill(closest+first, closest+last, -1);
+        kernels.indexed_triangle_packet_closest_hit(
+          triangle_packet, min_t, vertices, faces, begin, end, first, last,
+          max_t, u, v, closest);
+      }else
+      {
+        for(int r = first;r<last;r++)
+        {
+          closest[r] = kernels.indexed_triangle_closest_hit(
+            triangle_rays[r], min_t, vertices, faces, begin, end,
+            max_t+r, u+r, v+r);
+        }
+      }
+      bool found = false;
+      for(int r = first;r<last;r++)
+      {
+        if(closest[r] >= 0)
+        {
+          rays_records[r].t = max_t[r];
+          rays_records[r].primitive = closest[r];
+          rays_records[r].u = u[r];
+          rays_records[r].v = v[r];
+          found = true;
+        }
+      }
+      return found;
+    };
+  mesh->bvh.closest_hit_packet_leaves(rays, min_t, rays_max_t, leaf);
+}
+
+Eigen::Vector3d TriangleSoup::surface_normal(
+  const Ray & ray, const double min_t, const HitRecord & record) const
+{
+  if(mesh)
+  {
+    const int f = record.primitive;
+    const std::vector<Eigen::Vector3d> & vertices = mesh->vertices;
+    const std::vector<std::uint32_t> & faces = mesh->faces;
+    return face_normal(
+      vertices[faces[3*f]], vertices[faces[3*f+1]], vertices[faces[3*f+2]]);
+  }
+  // The record only says which member was hit, not where within it (e.g.,
+  // which triangle of a nested soup): repeat the member's search, which
+  // finds the same closest hit, to get its own record
+  const Object & member = *triangles[record.primitive];
+  HitRecord member_record;
+  member.hit(
+    ray, min_t, std::numeric_limits<double>::infinity(), member_record);
+  return member.surface_normal(ray, min_t, member_record);
+}
+
+bool TriangleSoup::any_hit(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  if(mesh)
+  {
+    if(mesh->faces.empty())
+    {
+      return false;
+    }
+    const SimdTriangleRay triangle_ray = simd_ray(TriangleRay(ray));
+    const auto leaf = [&](const int begin, const int end) -> bool
+      {
+        return simd_kernels().indexed_triangle_any_hit(
+          triangle_ray, min_t, max_t, mesh->vertices.data()->data(),
+          mesh->faces.data(), begin, end);
+      };
+    if(mesh->bvh.empty())
+    {
+      return leaf(0, mesh->num_slots());
+    }
+    return mesh->bvh.any_hit_leaves(ray, min_t, max_t, leaf);
+  }
+  if(bvh.empty())
+  {
+    for(const auto & triangle : triangles)
+    {
+      if(triangle->any_hit(ray, min_t, max_t))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+  return bvh.any_hit(ray, min_t, max_t,
+    [&](const int f) -> bool
+    {
+      return triangles[f]->any_hit(ray, min_t, max_t);
+    });
+}
+
+bool TriangleSoup::bounding_box(Eigen::AlignedBox3d & box) const
+{
+  if(!hierarchy().empty())
+  {
+    box = hierarchy().nodes[0].box;
+    return true;
+  }
+  box.setEmpty();
+  if(mesh)
+  {
+    for(const std::uint32_t v : mesh->faces)
+    {
+      box.extend(mesh->vertices[v]);
+    }
+    return true;
+  }
+  for(const auto & triangle : triangles)
+  {
+    Eigen::AlignedBox3d triangle_box;
+    if(!triangle->bounding_box(triangle_box))
+    {
+      return false;
+    }
+    box.extend(triangle_box);
+  }
+  return true;
+}
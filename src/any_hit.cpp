@@ -0,0 +1,45 @@
+#include "any_hit.h"
+
+bool any_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  const Scene & scene)
+{
+  if(scene.planes.any_hit(ray, min_t, max_t, 0, scene.planes.size()))
+  {
+    return true;
+  }
+  for(const int i : scene.unbounded)
+  {
+    if(scene.objects[i]->any_hit(ray, min_t, max_t))
+    {
+      return true;
+    }
+  }
+  const TriangleRay triangle_ray(ray);
+  return scene.bvh.any_hit_leaves(ray, min_t, max_t,
+    [&](const int begin, const int end) -> bool
+    {
+      const int sphere_end = scene.sphere_end[begin];
+      const int triangle_end = scene.triangle_end[begin];
+      const int spheres = scene.sphere_offset[begin];
+      const int triangles = scene.triangle_offset[begin];
+      if(scene.spheres.any_hit(
+          ray, min_t, max_t, spheres, spheres + sphere_end - begin) ||
+        (triangle_end > sphere_end && scene.triangles.any_hit(
+          triangle_ray, min_t, max_t,
+          triangles, triangles + triangle_end - sphere_end)))
+      {
+        return true;
+      }
+      for(int s = triangle_end;s<end;s++)
+      {
+        if(scene.objects[scene.slot_objects[s]]->any_hit(ray, min_t, max_t))
+        {
+          return true;
+        }
+      }
+      return false;
+    });
+}
@@ -1,6 +1,6 @@
 #include "blinn_phong_shading.h"
 // Hint:
-#include "first_hit.h"
+#include "any_hit.h"
 #include <iostream>
 #include <algorithm>
 
@@ -9,7 +9,7 @@ Eigen::Vector3d blinn_phong_shading(
   const int & hit_id, 
   const double & t,
   const Eigen::Vector3d & n,
-  const std::vector< std::shared_ptr<Object> > & objects,
+  const Scene & scene,
   const std::vector<std::shared_ptr<Light> > & lights)
 {
   ////////////////////////////////////////////////////////////////////////////
@@ -19,20 +19,20 @@ Eigen::Vector3d blinn_phong_shading(
   // rgb = kd * I * max(0, n*l) + ks * I * max(0, n*h)^p
 
   double inf = std::numeric_limits<double>::infinity();
-  // Epsilon as min_t, the second parameter in first_hit
+  // Epsilon as min_t, the second parameter in any_hit
   const double MIN_T = 0.1;
   // return value rgb
   Eigen::Vector3d rgb(0,0,0);
   // Preparing rgb calculation: kd, ks, p values
-  Eigen::Vector3d kd = objects[hit_id]->material->kd;
-  Eigen::Vector3d ks = objects[hit_id]->material->ks;
-  double p = objects[hit_id]->material->phong_exponent;
+  Eigen::Vector3d kd = scene.objects[hit_id]->material->kd;
+  Eigen::Vector3d ks = scene.objects[hit_id]->material->ks;
+  double p = scene.objects[hit_id]->material->phong_exponent;
 
   // Variables for direction
   Eigen::Vector3d v = ray.origin + t * ray.direction; // Intersection point
 
   // Procedural Checkerboard Texture
-  if (objects[hit_id]->material->is_checkerboard) {
+  if (scene.objects[hit_id]->material->is_checkerboard) {
       double scale = 2.0;
       int cx = (int)floor(v(0) * scale);
       int cz = (int)floor(v(2) * scale);
@@ -44,7 +44,7 @@ Eigen::Vector3d blinn_phong_shading(
   }
 
   // Procedural Noise Texture (Marble-like)
-  if (objects[hit_id]->material->is_noise) {
+  if (scene.objects[hit_id]->material->is_noise) {
       double scale = 5.0;
       double noise = 0.5 * (1.0 + sin(scale * v(0) + 5.0 * sin(scale * v(1) + scale * v(2))));
       kd = kd * noise + Eigen::Vector3d(1.0, 1.0, 1.0) * (1.0 - noise);
@@ -52,12 +52,9 @@ Eigen::Vector3d blinn_phong_shading(
 
   Eigen::Vector3d l;
   double max_t;
-  // Variables for first_hit
+  // Variables for shadow ray
   Ray check_ray;
-  int check_hit_id;
-  double check_t;
-  Eigen::Vector3d check_n;
-  bool hit = false;
+  bool blocked = false;
   // Variables for rgb calculation: I & h
   Eigen::Vector3d I;
   Eigen::Vector3d h;
@@ -67,13 +64,13 @@ Eigen::Vector3d blinn_phong_shading(
     v = ray.origin + t * ray.direction;
     lights[i]->direction(v,l,max_t);
 
-    // Variables for first_hit, and condition check check_t
+    // Shadow ray: is anything between v and the light?
     check_ray.origin = v;
     check_ray.direction = l;
-    hit = first_hit(check_ray,MIN_T,objects,check_hit_id,check_t,check_n);
+    blocked = any_hit(check_ray,MIN_T,max_t,scene);
 
-    // Proceed if not hit or check_t valid, find h and rgb value
-    if ( !hit || check_t > max_t ) {
+    // Proceed if not blocked, find h and rgb value
+    if ( !blocked ) {
       // Preparing rgb calculation: I & h value
       I = lights[i]->I;
       v = (-ray.direction).normalized();
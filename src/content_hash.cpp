@@ -0,0 +1,50 @@
+#include "content_hash.h"
+#include "MappedFile.h"
+#include <cstring>
+
+namespace
+{
+  const std::uint64_t MULTIPLIER = 0x9FB21C651E98DF25ull;
+
+  std::uint64_t mix(std::uint64_t h)
+  {
+    h ^= h >> 32;
+    h *= MULTIPLIER;
+    h ^= h >> 29;
+    return h;
+  }
+}
+
+std::uint64_t content_hash(
+  const void * data,
+  const std::size_t size,
+  const std::uint64_t seed)
+{
+  const char * bytes = static_cast<const char *>(data);
+  std::uint64_t h = seed ^ (size * MULTIPLIER) ^ 0x243F6A8885A308D3ull;
+  std::size_t i = 0;
+  for(;i+8<=size;i += 8)
+  {
+    std::uint64_t word;
+    std::memcpy(&word,bytes + i,8);
+    h = (h ^ mix(word)) * MULTIPLIER;
+  }
+  if(i < size)
+  {
+    std::uint64_t word = 0;
+    std::memcpy(&word,bytes + i,size - i);
+    h = (h ^ mix(word)) * MULTIPLIER;
+  }
+  return mix(h);
+}
+
+bool file_content_hash(const std::string & filename, std::uint64_t & hash)
+{
+  MappedFile file;
+  if(!file.open(filename))
+  {
+    return false;
+  }
+  hash = content_hash(file.data(),file.size());
+  return true;
+}
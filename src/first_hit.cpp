@@ -1,4 +1,5 @@
 #include "first_hit.h"
+#include <algorithm>
 
 bool first_hit(
   const Ray & ray, 
@@ -11,26 +12,218 @@ bool first_hit(
   ////////////////////////////////////////////////////////////////////////////
   // Replace with your code here:
   hit_id = -1;
-  bool intersect = false;
-  double smallest_t = INFINITY;
-  Eigen::Vector3d smallest_n;
+  // Closest hit so far; its normal is only evaluated once the search is over
+  HitRecord closest;
+  closest.t = INFINITY;
+  HitRecord record;
   
   for (int i = 0; i < objects.size(); i ++){
-    if (objects[i]->intersect(ray, min_t, t, n)){
-      intersect = true;
-      if (t < smallest_t){
-        // if intersect and smaller distance t
-        // update hit_id with smallest t value
-        hit_id = i;
-        smallest_t = t;
-        smallest_n = n;
-      }
+    if (objects[i]->hit(ray, min_t, closest.t, record)){
+      // if intersect and smaller distance t
+      // update hit_id with smallest t value
+      hit_id = i;
+      closest = record;
     }
   }
-  if (!intersect)
+  if (hit_id < 0)
     return false;
-  t = smallest_t;
-  n = smallest_n;
+  t = closest.t;
+  n = objects[hit_id]->surface_normal(ray, min_t, closest);
   return true;
   ////////////////////////////////////////////////////////////////////////////
 }
+
+bool first_hit(
+  const Ray & ray, 
+  const double min_t,
+  const Scene & scene,
+  int & hit_id, 
+  double & t,
+  Eigen::Vector3d & n)
+{
+  hit_id = -1;
+  HitRecord closest;
+  closest.t = INFINITY;
+  HitRecord record;
+  // Planes and other unbounded objects first: they bound the tree search
+  const int p = scene.planes.closest_hit(
+    ray, min_t, 0, scene.planes.size(), closest.t);
+  if(p >= 0)
+  {
+    hit_id = scene.plane_objects[p];
+    closest.primitive = -1;
+  }
+  for(const int i : scene.unbounded)
+  {
+    if(scene.objects[i]->hit(ray, min_t, closest.t, record))
+    {
+      hit_id = i;
+      closest = record;
+    }
+  }
+  const TriangleRay triangle_ray(ray);
+  scene.bvh.closest_hit_leaves(ray, min_t, closest.t,
+    [&](const int begin, const int end, double & max_t) -> bool
+    {
+      bool found = false;
+      const int sphere_end = scene.sphere_end[begin];
+      const int triangle_end = scene.triangle_end[begin];
+      // Leaf's entries in the sphere and triangle batches
+      const int spheres = scene.sphere_offset[begin];
+      const int triangles = scene.triangle_offset[begin];
+      // All plain spheres of the leaf at once
+      const int s = scene.spheres.closest_hit(
+        ray, min_t, spheres, spheres + sphere_end - begin, max_t);
+      if(s >= 0)
+      {
+        hit_id = scene.slot_objects[begin + s - spheres];
+        closest.t = max_t;
+        closest.primitive = -1;
+        found = true;
+      }
+      // Then all plain triangles
+      if(triangle_end > sphere_end)
+      {
+        double u, v;
+        const int s = scene.triangles.closest_hit(
+          triangle_ray, min_t,
+          triangles, triangles + triangle_end - sphere_end, max_t, u, v);
+        if(s >= 0)
+        {
+          hit_id = scene.slot_objects[sphere_end + s - triangles];
+          closest.t = max_t;
+          closest.primitive = -1;
+          closest.u = u;
+          closest.v = v;
+          found = true;
+        }
+      }
+      // Everything else one by one
+      for(int s = triangle_end;s<end;s++)
+      {
+        const int i = scene.slot_objects[s];
+        if(scene.objects[i]->hit(ray, min_t, max_t, record))
+        {
+          hit_id = i;
+          closest = record;
+          max_t = record.t;
+          found = true;
+        }
+      }
+      return found;
+    });
+  if(hit_id < 0)
+  {
+    return false;
+  }
+  t = closest.t;
+  n = scene.objects[hit_id]->surface_normal(ray, min_t, closest);
+  return true;
+}
+
+void first_hit(
+  const RayPacket & packet,
+  const double min_t,
+  const Scene & scene,
+  int * hit_id,
+  double * t,
+  Eigen::Vector3d * n)
+{
+  HitRecord closest[RayPacket::MAX_SIZE];
+  HitRecord records[RayPacket::MAX_SIZE];
+  double max_t[RayPacket::MAX_SIZE];
+  // Planes and other unbounded objects first, ray by ray
+  for(int r = 0;r<packet.size;r++)
+  {
+    const Ray & ray = packet.rays[r];
+    hit_id[r] = -1;
+    closest[r].t = INFINITY;
+    const int p = scene.planes.closest_hit(
+      ray, min_t, 0, scene.planes.size(), closest[r].t);
+    if(p >= 0)
+    {
+      hit_id[r] = scene.plane_objects[p];
+      closest[r].primitive = -1;
+    }
+    for(const int i : scene.unbounded)
+    {
+      if(scene.objects[i]->hit(ray, min_t, closest[r].t, records[r]))
+      {
+        hit_id[r] = i;
+        closest[r] = records[r];
+      }
+    }
+    max_t[r] = closest[r].t;
+  }
+  scene.bvh.closest_hit_packet_leaves(packet, min_t, max_t,
+    [&](const int begin, const int end, const int first, const int last,
+      double * max_t) -> bool
+    {
+      bool found = false;
+      const int sphere_end = scene.sphere_end[begin];
+      const int triangle_end = scene.triangle_end[begin];
+      // Leaf's entries in the sphere and triangle batches
+      const int spheres = scene.sphere_offset[begin];
+      const int triangles = scene.triangle_offset[begin];
+      // Plain spheres and triangles of the leaf as batches, ray by ray
+      for(int r = first;r<last;r++)
+      {
+        const Ray & ray = packet.rays[r];
+        const int s = scene.spheres.closest_hit(
+          ray, min_t, spheres, spheres + sphere_end - begin, max_t[r]);
+        if(s >= 0)
+        {
+          hit_id[r] = scene.slot_objects[begin + s - spheres];
+          closest[r].t = max_t[r];
+          closest[r].primitive = -1;
+          found = true;
+        }
+        if(triangle_end > sphere_end)
+        {
+          double u, v;
+          const int s = scene.triangles.closest_hit(
+            TriangleRay(ray), min_t,
+            triangles, triangles + triangle_end - sphere_end, max_t[r],
+            u, v);
+          if(s >= 0)
+          {
+            hit_id[r] = scene.slot_objects[sphere_end + s - triangles];
+            closest[r].t = max_t[r];
+            closest[r].primitive = -1;
+            closest[r].u = u;
+            closest[r].v = v;
+            found = true;
+          }
+        }
+      }
+      // Everything else with all rays at once (soups and instances carry the
+      // packet into their own hierarchies)
+      double previous_t[RayPacket::MAX_SIZE];
+      for(int s = triangle_end;s<end;s++)
+      {
+        const int i = scene.slot_objects[s];
+        std::copy(max_t+first, max_t+last, previous_t+first);
+        scene.objects[i]->hit_packet(
+          packet, first, last, min_t, max_t, records);
+        for(int r = first;r<last;r++)
+        {
+          if(max_t[r] < previous_t[r])
+          {
+            hit_id[r] = i;
+            closest[r] = records[r];
+            found = true;
+          }
+        }
+      }
+      return found;
+    });
+  for(int r = 0;r<packet.size;r++)
+  {
+    if(hit_id[r] >= 0)
+    {
+      t[r] = closest[r].t;
+      n[r] = scene.objects[hit_id[r]]->surface_normal(
+        packet.rays[r], min_t, closest[r]);
+    }
+  }
+}
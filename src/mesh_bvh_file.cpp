@@ -0,0 +1,139 @@
+#include "mesh_bvh_file.h"
+#include "MappedFile.h"
+#include "binary_io.h"
+#include "content_hash.h"
+#include <sys/stat.h>
+#include <cstdio>
+
+namespace
+{
+  const char MAGIC[8] = {'R','T','M','E','S','H','\n','\0'};
+  // Bump whenever the layout below changes
+  const std::uint32_t VERSION = 3;
+
+  std::string bvh_path(const std::string & stl_filename)
+  {
+    return stl_filename + ".bvh";
+  }
+
+  // Identity of the .stl file: its size, modification time and hash
+  struct Source
+  {
+    std::uint64_t size;
+    std::int64_t mtime;
+    std::uint64_t hash;
+  };
+
+  bool stat_source(
+    const std::string & stl_filename,
+    const std::uint64_t stl_hash,
+    Source & source)
+  {
+    struct stat info;
+    if(stat(stl_filename.c_str(),&info) != 0)
+    {
+      return false;
+    }
+    source.size = info.st_size;
+    source.mtime = info.st_mtime;
+    source.hash = stl_hash;
+    return true;
+  }
+}
+
+bool read_mesh_bvh(
+  const std::string & stl_filename,
+  const std::uint64_t stl_hash,
+  const BVH::BuildMethod method,
+  TriangleMesh & mesh)
+{
+  mesh = TriangleMesh();
+  Source source;
+  MappedFile file;
+  if(!stat_source(stl_filename,stl_hash,source) ||
+    !file.open(bvh_path(stl_filename)))
+  {
+    return false;
+  }
+  BinaryReader reader{file.data(),file.data() + file.size()};
+  char magic[sizeof(MAGIC)];
+  std::uint32_t version, node_size, stored_method;
+  Source stored;
+  std::uint64_t payload_hash;
+  bool valid =
+    reader.read_bytes(magic,sizeof(magic)) &&
+    std::memcmp(magic,MAGIC,sizeof(MAGIC)) == 0 &&
+    reader.read(version) && version == VERSION &&
+    reader.read(node_size) && node_size == sizeof(BVH::Node) &&
+    reader.read(stored.size) && stored.size == source.size &&
+    reader.read(stored.mtime) && stored.mtime == source.mtime &&
+    reader.read(stored.hash) && stored.hash == source.hash &&
+    reader.read(stored_method) && stored_method == (std::uint32_t)method &&
+    reader.read(payload_hash) &&
+    content_hash(reader.p,reader.end - reader.p) == payload_hash;
+
+  valid = valid &&
+    reader.read(mesh.vertices) &&
+    reader.read(mesh.faces) &&
+    mesh.faces.size() % 3 == 0 &&
+    reader.read(mesh.num_triangles) &&
+    mesh.num_triangles >= 0 && mesh.num_triangles <= mesh.num_slots() &&
+    mesh.bvh.read(reader) &&
+    (int)mesh.bvh.indices.size() == mesh.num_slots() &&
+    reader.p == reader.end;
+  for(const std::uint32_t v : mesh.faces)
+  {
+    valid = valid && v < mesh.vertices.size();
+  }
+  if(!valid)
+  {
+    mesh = TriangleMesh();
+  }
+  return valid;
+}
+
+bool write_mesh_bvh(
+  const std::string & stl_filename,
+  const std::uint64_t stl_hash,
+  const TriangleMesh & mesh)
+{
+  Source source;
+  if(!stat_source(stl_filename,stl_hash,source))
+  {
+    return false;
+  }
+  std::string payload;
+  write_binary(payload,mesh.vertices);
+  write_binary(payload,mesh.faces);
+  write_binary(payload,mesh.num_triangles);
+  mesh.bvh.write(payload);
+
+  std::string buffer(MAGIC,sizeof(MAGIC));
+  write_binary(buffer,VERSION);
+  write_binary(buffer,(std::uint32_t)sizeof(BVH::Node));
+  write_binary(buffer,source.size);
+  write_binary(buffer,source.mtime);
+  write_binary(buffer,source.hash);
+  write_binary(buffer,(std::uint32_t)mesh.bvh.build_stats.method);
+  write_binary(buffer,content_hash(payload.data(),payload.size()));
+  buffer += payload;
+
+  // Write next to the final name and rename, so that a concurrent reader
+  // never sees a half written file
+  const std::string path = bvh_path(stl_filename);
+  const std::string temporary = path + ".tmp";
+  FILE * file = std::fopen(temporary.c_str(),"wb");
+  if(!file)
+  {
+    return false;
+  }
+  const bool written =
+    std::fwrite(buffer.data(),1,buffer.size(),file) == buffer.size();
+  if(std::fclose(file) != 0 || !written ||
+    std::rename(temporary.c_str(),path.c_str()) != 0)
+  {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
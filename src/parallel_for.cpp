@@ -0,0 +1,45 @@
+#include "parallel_for.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+void parallel_for(
+  const int n,
+  const std::function<void(int)> & task,
+  const int num_threads)
+{
+  int workers = num_threads;
+  if(workers <= 0)
+  {
+    workers = std::max<int>(std::thread::hardware_concurrency(),1);
+  }
+  workers = std::min(workers,n);
+  if(workers <= 1)
+  {
+    for(int i = 0;i<n;i++)
+    {
+      task(i);
+    }
+    return;
+  }
+
+  std::atomic<int> next(0);
+  auto work = [&]()
+  {
+    for(int i = next++;i<n;i = next++)
+    {
+      task(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for(int w = 1;w<workers;w++)
+  {
+    threads.emplace_back(work);
+  }
+  work();
+  for(std::thread & thread : threads)
+  {
+    thread.join();
+  }
+}
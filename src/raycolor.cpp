@@ -3,19 +3,22 @@
 #include "blinn_phong_shading.h"
 #include "reflect.h"
 
+namespace
+{
+  const int MAX_RECURSIVE_CALLS = 5;  // maximum recursive calls allowed
+  const double MIN_T_TMP = 0.0001;     // min_t value for raycolor recursive call
+}
+
 bool raycolor(
   const Ray & ray, 
   const double min_t,
-  const std::vector< std::shared_ptr<Object> > & objects,
+  const Scene & scene,
   const std::vector< std::shared_ptr<Light> > & lights,
   const int num_recursive_calls,
   Eigen::Vector3d & rgb)
 {
   ////////////////////////////////////////////////////////////////////////////
   // Replace with your code here:
-  const int MAX_RECURSIVE_CALLS = 5;  // maximum recursive calls allowed
-  const double MIN_T_TMP = 0.0001;     // min_t value for raycolor recursive call
-
   if (num_recursive_calls > MAX_RECURSIVE_CALLS)
     return false;
 
@@ -23,22 +26,39 @@ bool raycolor(
   int hit_id;
   double t;
   Eigen::Vector3d n;
-  bool hit = first_hit(ray, min_t, objects, hit_id, t, n);
-
-  if (hit) {
-    // find ray colour rgb using blinn_phong_shading
-    rgb = blinn_phong_shading(ray, hit_id, t, n, objects, lights);
-
-    // Variables for raycolor
-    Ray tmp_ray;
-    tmp_ray.origin = ray.origin + t * ray.direction;
-    tmp_ray.direction = reflect(ray.direction, n);
-    Eigen::Vector3d tmp_rgb;
-    if (raycolor(tmp_ray, MIN_T_TMP, objects, lights, num_recursive_calls + 1, tmp_rgb))
-      // delta = mirror * ray 
-      rgb = rgb + (objects[hit_id]->material->km.array() * tmp_rgb.array()).matrix();
-  }
+  bool hit = first_hit(ray, min_t, scene, hit_id, t, n);
+
+  if (hit)
+    raycolor(ray, scene, lights, num_recursive_calls, hit_id, t, n, rgb);
 
   return hit;
   ////////////////////////////////////////////////////////////////////////////
 }
+
+bool raycolor(
+  const Ray & ray,
+  const Scene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const int num_recursive_calls,
+  const int hit_id,
+  const double t,
+  const Eigen::Vector3d & n,
+  Eigen::Vector3d & rgb)
+{
+  if (hit_id < 0)
+    return false;
+
+  // find ray colour rgb using blinn_phong_shading
+  rgb = blinn_phong_shading(ray, hit_id, t, n, scene, lights);
+
+  // Variables for raycolor
+  Ray tmp_ray;
+  tmp_ray.origin = ray.origin + t * ray.direction;
+  tmp_ray.direction = reflect(ray.direction, n);
+  Eigen::Vector3d tmp_rgb;
+  if (raycolor(tmp_ray, MIN_T_TMP, scene, lights, num_recursive_calls + 1, tmp_rgb))
+    // delta = mirror * ray 
+    rgb = rgb + (scene.objects[hit_id]->material->km.array() * tmp_rgb.array()).matrix();
+
+  return true;
+}
@@ -0,0 +1,386 @@
+#include "read_stl.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+  // Binary layout: 80 byte header, uint32 facet count, then per facet a
+  // normal and three corners (12 little-endian float32) and a uint16
+  // attribute
+  const std::size_t HEADER_SIZE = 84;
+  const std::size_t RECORD_SIZE = 50;
+
+  // Whether the first word of the header is "solid", which ascii files
+  // start with (and, unhelpfully, some binary ones too)
+  bool starts_with_solid(const char * data, const std::size_t size)
+  {
+    std::size_t i = 0;
+    while(i<size && std::isspace(static_cast<unsigned char>(data[i])))
+    {
+      i++;
+    }
+    return size >= i + 5 && std::strncmp(data + i,"solid",5) == 0 &&
+      (size == i + 5 ||
+       std::isspace(static_cast<unsigned char>(data[i+5])) ||
+       data[i+5] == '\0');
+  }
+
+  bool is_space(const char c)
+  {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' ||
+      c == '\v' || c == '\f';
+  }
+
+  // Powers of ten that are exact in double precision
+  const double EXACT_POWERS_OF_TEN[] = {
+    1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,1e10,1e11,
+    1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22};
+
+  // Parse a whole token as a decimal number, with the same result as strtod
+  // (and hence fscanf("%lg")). Tokens with at most 19 significant digits
+  // whose mantissa and power of ten are both exact doubles take Clinger's
+  // fast path (a single correctly rounded multiply or divide); anything
+  // else is handed to strtod.
+  //
+  // Inputs:
+  //   begin,end  characters of the token
+  // Outputs:
+  //   x  parsed value
+  // Returns true iff the whole token is a number
+  bool parse_number(const char * begin, const char * end, double & x)
+  {
+    const char * p = begin;
+    const bool negative = p<end && *p == '-';
+    if(p<end && (*p == '-' || *p == '+'))
+    {
+      p++;
+    }
+    std::uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any_digit = false;
+    bool exact = true;
+    for(;p<end && *p >= '0' && *p <= '9';p++)
+    {
+      any_digit = true;
+      if(digits < 19)
+      {
+        mantissa = 10*mantissa + (*p - '0');
+        digits += mantissa > 0;
+      }else
+      {
+        exact = false;
+      }
+    }
+    if(p<end && *p == '.')
+    {
+      for(p++;p<end && *p >= '0' && *p <= '9';p++)
+      {
+        any_digit = true;
+        if(digits < 19)
+        {
+          mantissa = 10*mantissa + (*p - '0');
+          digits += mantissa > 0;
+          exponent--;
+        }else
+        {
+          exact = false;
+        }
+      }
+    }
+    if(any_digit && p<end && (*p == 'e' || *p == 'E'))
+    {
+      p++;
+      const bool negative_exponent = p<end && *p == '-';
+      if(p<end && (*p == '-' || *p == '+'))
+      {
+        p++;
+      }
+      int e = 0;
+      bool any_exponent_digit = false;
+      for(;p<end && *p >= '0' && *p <= '9';p++)
+      {
+        any_exponent_digit = true;
+        e = e < 10000 ? 10*e + (*p - '0') : e;
+      }
+      exact = exact && any_exponent_digit;
+      exponent += negative_exponent ? -e : e;
+    }
+    if(any_digit && exact && p == end &&
+      mantissa <= (std::uint64_t(1)<<53) &&
+      exponent >= -22 && exponent <= 22)
+    {
+      x = exponent < 0 ?
+        double(mantissa) / EXACT_POWERS_OF_TEN[-exponent] :
+        double(mantissa) * EXACT_POWERS_OF_TEN[exponent];
+      x = negative ? -x : x;
+      return true;
+    }
+    // Slow path (long mantissas, large exponents, inf, nan, ...): strtod
+    // needs a terminated copy
+    char token[128];
+    if(end - begin >= (std::ptrdiff_t)sizeof(token))
+    {
+      return false;
+    }
+    std::memcpy(token,begin,end - begin);
+    token[end - begin] = '\0';
+    char * parsed;
+    x = std::strtod(token,&parsed);
+    return parsed == token + (end - begin) && parsed != token;
+  }
+
+  // Whitespace separated words of an ascii STL
+  struct Scanner
+  {
+    const char * p;
+    const char * end;
+
+    // Next word, empty at the end of the input
+    bool next(const char * & word_begin, const char * & word_end)
+    {
+      while(p<end && is_space(*p))
+      {
+        p++;
+      }
+      word_begin = p;
+      while(p<end && !is_space(*p))
+      {
+        p++;
+      }
+      word_end = p;
+      return word_begin < word_end;
+    }
+    // Skip to the start of the next line
+    void skip_line()
+    {
+      while(p<end && *p != '\n')
+      {
+        p++;
+      }
+    }
+    // Whether the next word is the keyword
+    bool expect(const char * keyword)
+    {
+      const char * b, * e;
+      return next(b,e) && equals(b,e,keyword);
+    }
+    static bool equals(const char * b, const char * e, const char * keyword)
+    {
+      return std::size_t(e - b) == std::strlen(keyword) &&
+        std::strncmp(b,keyword,e - b) == 0;
+    }
+    bool number(double & x)
+    {
+      const char * b, * e;
+      return next(b,e) && parse_number(b,e,x);
+    }
+  };
+
+  // Whether the ascii STL text at p (past the "solid name" line) begins a
+  // facet: the whole word "facet" (or "faced") followed by the word "normal"
+  bool starts_facet(const char * p, const char * data_end)
+  {
+    if(!is_space(p[-1]) || data_end - p < 6 || !is_space(p[5]) ||
+      !(std::strncmp(p,"facet",5) == 0 || std::strncmp(p,"faced",5) == 0))
+    {
+      return false;
+    }
+    Scanner scanner{p+5,data_end};
+    return scanner.expect("normal");
+  }
+
+  // Parse the facets starting in [begin,end) of an ascii STL whose text
+  // continues to data_end. Facets are "facet normal nx ny nz outer loop
+  // vertex x y z (three times) endloop endfacet". Files holding several
+  // solids are read whole: "endsolid name" and "solid name" lines are
+  // skipped.
+  //
+  // Outputs:
+  //   corners  3 corners per facet, appended
+  //   error  position of a parse error (unchanged if none)
+  // Returns false on a parse error
+  bool parse_ascii_facets(
+    const char * begin,
+    const char * end,
+    const char * data_end,
+    std::vector<Eigen::Vector3d> & corners,
+    const char * & error)
+  {
+    Scanner scanner{begin,data_end};
+    while(true)
+    {
+      const char * b, * e;
+      const char * position = scanner.p;
+      if(!scanner.next(b,e) || b >= end)
+      {
+        return true;
+      }
+      if(Scanner::equals(b,e,"endsolid") || Scanner::equals(b,e,"solid"))
+      {
+        scanner.skip_line();
+        continue;
+      }
+      double n[3];
+      // Some exporters famously misspell facet
+      if(!(Scanner::equals(b,e,"facet") || Scanner::equals(b,e,"faced")) ||
+        !scanner.expect("normal") ||
+        !scanner.number(n[0]) ||
+        !scanner.number(n[1]) ||
+        !scanner.number(n[2]) ||
+        !scanner.expect("outer") ||
+        !scanner.expect("loop"))
+      {
+        error = position;
+        return false;
+      }
+      for(int c = 0;c<3;c++)
+      {
+        Eigen::Vector3d v;
+        if(!scanner.expect("vertex") ||
+          !scanner.number(v(0)) ||
+          !scanner.number(v(1)) ||
+          !scanner.number(v(2)))
+        {
+          error = position;
+          return false;
+        }
+        corners.push_back(v);
+      }
+      if(!scanner.expect("endloop") || !scanner.expect("endfacet"))
+      {
+        error = position;
+        return false;
+      }
+    }
+  }
+
+  // Below this size an ascii file is parsed by a single thread
+  const std::size_t MIN_CHUNK_SIZE = 1<<20;
+
+  // Parse an ascii STL. Large files are cut into chunks at facet
+  // boundaries, which are parsed concurrently and then concatenated.
+  bool read_ascii_stl(
+    const std::string & filename,
+    const char * data,
+    const std::size_t size,
+    std::vector<Eigen::Vector3d> & corners)
+  {
+    const char * data_end = data + size;
+    // Skip the "solid name" line
+    const char * body = std::find(data,data_end,'\n');
+    const std::size_t body_size = data_end - body;
+    const int num_chunks = std::max<int>(1,std::min<std::size_t>(
+      std::thread::hardware_concurrency(),body_size/MIN_CHUNK_SIZE));
+    // Chunk c covers [starts[c],starts[c+1]); move every cut forward to the
+    // next facet keyword, so that a cut never lands inside a solid's name
+    std::vector<const char *> starts(num_chunks+1,data_end);
+    starts[0] = body;
+    for(int c = 1;c<num_chunks;c++)
+    {
+      const char * p = std::max(body + body_size*c/num_chunks,starts[c-1]);
+      while(p<data_end && !starts_facet(p,data_end))
+      {
+        p++;
+      }
+      starts[c] = p;
+    }
+
+    std::vector<std::vector<Eigen::Vector3d> > chunk_corners(num_chunks);
+    std::vector<const char *> errors(num_chunks,nullptr);
+    auto parse = [&](const int c)
+    {
+      // Roughly 250 bytes of text per facet
+      chunk_corners[c].reserve(3*(starts[c+1] - starts[c])/250);
+      parse_ascii_facets(
+        starts[c],starts[c+1],data_end,chunk_corners[c],errors[c]);
+    };
+    std::vector<std::thread> threads;
+    for(int c = 1;c<num_chunks;c++)
+    {
+      threads.emplace_back(parse,c);
+    }
+    parse(0);
+    for(std::thread & thread : threads)
+    {
+      thread.join();
+    }
+
+    std::size_t total = 0;
+    for(int c = 0;c<num_chunks;c++)
+    {
+      if(errors[c])
+      {
+        std::cerr<<"IOError: "<<filename<<": bad ascii STL format at byte "<<
+          errors[c] - data<<"."<<std::endl;
+        return false;
+      }
+      total += chunk_corners[c].size();
+    }
+    corners.reserve(total);
+    for(const auto & chunk : chunk_corners)
+    {
+      corners.insert(corners.end(),chunk.begin(),chunk.end());
+    }
+    return true;
+  }
+}
+
+bool read_stl(
+  const std::string & filename,
+  std::vector<Eigen::Vector3d> & corners)
+{
+  corners.clear();
+  MappedFile file;
+  if(!file.open(filename))
+  {
+    std::cerr<<"IOError: "<<filename<<" could not be opened..."<<std::endl;
+    return false;
+  }
+  const char * data = file.data();
+  const std::size_t size = file.size();
+  if(size < HEADER_SIZE)
+  {
+    if(starts_with_solid(data,size))
+    {
+      return read_ascii_stl(filename,data,size,corners);
+    }
+    std::cerr<<"IOError: "<<filename<<" is too short."<<std::endl;
+    return false;
+  }
+  std::uint32_t num_faces;
+  std::memcpy(&num_faces,data + 80,sizeof(num_faces));
+  const std::size_t binary_size = HEADER_SIZE + RECORD_SIZE * num_faces;
+  // A "solid" header only means binary if the size matches the facet count
+  // exactly
+  if(starts_with_solid(data,size) && size != binary_size)
+  {
+    return read_ascii_stl(filename,data,size,corners);
+  }
+  if(size < binary_size)
+  {
+    std::cerr<<"IOError: "<<filename<<" is truncated ("<<num_faces<<
+      " facets need "<<binary_size<<" bytes, have "<<size<<")."<<std::endl;
+    return false;
+  }
+
+  corners.resize(3*(std::size_t)num_faces);
+  const char * record = data + HEADER_SIZE;
+  for(std::size_t f = 0;f<num_faces;f++,record += RECORD_SIZE)
+  {
+    // Records are packed at 50 byte strides, so the floats are unaligned.
+    // STL is little-endian, as are all platforms this builds on.
+    float v[9];
+    std::memcpy(v,record + 12,sizeof(v));
+    corners[3*f+0] = Eigen::Vector3d(v[0],v[1],v[2]);
+    corners[3*f+1] = Eigen::Vector3d(v[3],v[4],v[5]);
+    corners[3*f+2] = Eigen::Vector3d(v[6],v[7],v[8]);
+  }
+  return true;
+}
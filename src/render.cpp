@@ -0,0 +1,241 @@
+#include "render.h"
+#include "viewing_ray.h"
+#include "raycolor.h"
+#include "first_hit.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+  // Tile edge length in pixels
+  const int TILE_SIZE = 16;
+
+  struct Tile
+  {
+    int row, col, rows, cols;
+  };
+
+  // Tiles owned by one worker. The owner takes from the front, thieves take
+  // from the back, so stolen work is as far as possible from what the owner
+  // is about to touch.
+  struct TileQueue
+  {
+    std::mutex mutex;
+    std::deque<Tile> tiles;
+  };
+
+  // Trace the viewing rays of a block of pixels as one packet and store
+  // their colors
+  //
+  // Inputs:
+  //   row,col  top left pixel of block
+  //   size  block edge length (at most 8)
+  //   rows,cols  pixels of the block inside the tile
+  // Outputs:
+  //   tile_rgb  colors of the tile's pixels, row by row
+  void render_packet(
+    const Camera & camera,
+    const Scene & scene,
+    const std::vector<std::shared_ptr<Light> > & lights,
+    const int width,
+    const int height,
+    const Tile & tile,
+    const int row,
+    const int col,
+    const int size,
+    const int rows,
+    const int cols,
+    double * tile_rgb)
+  {
+    // Rays in Morton order, so that rays close in the packet (which
+    // traversal narrows to ranges of) are close in the image
+    RayPacket packet;
+    int pixels[RayPacket::MAX_SIZE];
+    for(int m = 0;m<size*size;m++)
+    {
+      // Column from the even bits of m, row from the odd ones
+      int di = 0, dj = 0;
+      for(int b = 0;(1<<b)<size;b++)
+      {
+        dj |= ((m>>(2*b))&1)<<b;
+        di |= ((m>>(2*b+1))&1)<<b;
+      }
+      if(di >= rows || dj >= cols)
+      {
+        continue;
+      }
+      viewing_ray(
+        camera,row+di,col+dj,width,height,packet.rays[packet.size]);
+      pixels[packet.size++] = (row+di-tile.row)*TILE_SIZE + col+dj-tile.col;
+    }
+
+    int hit_id[RayPacket::MAX_SIZE];
+    double t[RayPacket::MAX_SIZE];
+    Eigen::Vector3d n[RayPacket::MAX_SIZE];
+    first_hit(packet,1.0,scene,hit_id,t,n);
+    for(int r = 0;r<packet.size;r++)
+    {
+      // Set background color, then shade the hit and follow reflections
+      Eigen::Vector3d rgb(0,0,0);
+      raycolor(packet.rays[r],scene,lights,0,hit_id[r],t[r],n[r],rgb);
+      tile_rgb[0+3*pixels[r]] = rgb(0);
+      tile_rgb[1+3*pixels[r]] = rgb(1);
+      tile_rgb[2+3*pixels[r]] = rgb(2);
+    }
+  }
+
+  void render_tile(
+    const Camera & camera,
+    const Scene & scene,
+    const std::vector<std::shared_ptr<Light> > & lights,
+    const int width,
+    const int height,
+    const int packet_size,
+    const Tile & tile,
+    std::vector<unsigned char> & rgb_image)
+  {
+    // Double precision colors of the tile, row by row
+    double tile_rgb[3*TILE_SIZE*TILE_SIZE];
+    if(packet_size > 1)
+    {
+      for(int i = tile.row;i<tile.row+tile.rows;i += packet_size)
+      {
+        for(int j = tile.col;j<tile.col+tile.cols;j += packet_size)
+        {
+          render_packet(camera,scene,lights,width,height,tile,i,j,
+            packet_size,
+            std::min(packet_size,tile.row+tile.rows-i),
+            std::min(packet_size,tile.col+tile.cols-j),
+            tile_rgb);
+        }
+      }
+    }else
+    {
+      for(int i = tile.row;i<tile.row+tile.rows;i++)
+      {
+        for(int j = tile.col;j<tile.col+tile.cols;j++)
+        {
+          // Set background color
+          Eigen::Vector3d rgb(0,0,0);
+
+          // Compute viewing ray
+          Ray ray;
+          viewing_ray(camera,i,j,width,height,ray);
+
+          // Shoot ray and collect color
+          raycolor(ray,1.0,scene,lights,0,rgb);
+
+          double * pixel = tile_rgb + 3*((i-tile.row)*TILE_SIZE + j-tile.col);
+          pixel[0] = rgb(0);
+          pixel[1] = rgb(1);
+          pixel[2] = rgb(2);
+        }
+      }
+    }
+    // Write double precision colors into image
+    for(int i = tile.row;i<tile.row+tile.rows;i++)
+    {
+      simd_kernels().quantize(tile_rgb + 3*(i-tile.row)*TILE_SIZE,
+        3*tile.cols,&rgb_image[3*(tile.col+width*i)]);
+    }
+  }
+}
+
+void render(
+  const Camera & camera,
+  const Scene & scene,
+  const std::vector<std::shared_ptr<Light> > & lights,
+  const int width,
+  const int height,
+  const int num_threads,
+  const int packet_size,
+  std::vector<unsigned char> & rgb_image)
+{
+  rgb_image.resize(3*width*height);
+
+  std::vector<Tile> tiles;
+  for(int row = 0;row<height;row += TILE_SIZE)
+  {
+    for(int col = 0;col<width;col += TILE_SIZE)
+    {
+      tiles.push_back(Tile{
+        row,col,std::min(TILE_SIZE,height-row),std::min(TILE_SIZE,width-col)});
+    }
+  }
+
+  int workers = num_threads;
+  if(workers <= 0)
+  {
+    workers = std::max<int>(std::thread::hardware_concurrency(),1);
+  }
+  workers = std::min<int>(workers,tiles.size());
+  if(workers <= 1)
+  {
+    for(const Tile & tile : tiles)
+    {
+      render_tile(
+        camera,scene,lights,width,height,packet_size,tile,rgb_image);
+    }
+    return;
+  }
+
+  // Deal out contiguous bands of tiles so each worker starts on a coherent
+  // region of the image
+  std::vector<TileQueue> queues(workers);
+  for(int t = 0;t<(int)tiles.size();t++)
+  {
+    queues[(long long)t*workers/tiles.size()].tiles.push_back(tiles[t]);
+  }
+
+  auto work = [&](const int self)
+  {
+    while(true)
+    {
+      Tile tile;
+      bool found = false;
+      {
+        std::lock_guard<std::mutex> lock(queues[self].mutex);
+        if(!queues[self].tiles.empty())
+        {
+          tile = queues[self].tiles.front();
+          queues[self].tiles.pop_front();
+          found = true;
+        }
+      }
+      // Own queue is dry: try to steal from the others
+      for(int k = 1;!found && k<workers;k++)
+      {
+        TileQueue & victim = queues[(self+k)%workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tiles.empty())
+        {
+          tile = victim.tiles.back();
+          victim.tiles.pop_back();
+          found = true;
+        }
+      }
+      // Tiles are never added after start up, so nothing left anywhere
+      // means all work has been handed out
+      if(!found)
+      {
+        return;
+      }
+      render_tile(
+        camera,scene,lights,width,height,packet_size,tile,rgb_image);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for(int w = 1;w<workers;w++)
+  {
+    threads.emplace_back(work,w);
+  }
+  work(0);
+  for(std::thread & thread : threads)
+  {
+    thread.join();
+  }
+}
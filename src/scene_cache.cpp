@@ -0,0 +1,615 @@
+#include "scene_cache.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "binary_io.h"
+#include "content_hash.h"
+#include "dirname.h"
+#include "DirectionalLight.h"
+#include "Instance.h"
+#include "Material.h"
+#include "Plane.h"
+#include "PointLight.h"
+#include "Sphere.h"
+#include "Triangle.h"
+#include "TriangleSoup.h"
+#include <cstdio>
+#include <map>
+#include <typeinfo>
+
+namespace
+{
+  const char MAGIC[8] = {'R','T','S','C','E','N','E','\n'};
+  // Bump whenever the layout below changes
+  const std::uint32_t VERSION = 8;
+
+  enum ObjectType : std::uint8_t
+  {
+    SPHERE = 0,
+    PLANE = 1,
+    TRIANGLE = 2,
+    // Soup of an indexed mesh
+    SOUP = 3,
+    // Soup of arbitrary objects
+    GROUP = 4,
+    INSTANCE = 5
+  };
+  // Instances may nest groups inside groups; deeper files are rejected
+  const int MAX_NESTING = 32;
+  enum LightType : std::uint8_t
+  {
+    DIRECTIONAL = 0,
+    POINT = 1
+  };
+
+  std::string cache_path(const std::string & filename)
+  {
+    return filename + ".cache";
+  }
+
+  // Mesh paths are stored relative to the scene's directory when possible,
+  // so that the cache survives running from another working directory
+  std::string scene_directory(const std::string & filename)
+  {
+#if defined(WIN32) || defined(_WIN32)
+    return igl::dirname(filename) + "\\";
+#else
+    return igl::dirname(filename) + "/";
+#endif
+  }
+
+  bool is_absolute(const std::string & path)
+  {
+#if defined(WIN32) || defined(_WIN32)
+    return path.size() > 1 && (path[1] == ':' || path[0] == '\\');
+#else
+    return !path.empty() && path[0] == '/';
+#endif
+  }
+
+  // Header: magic, version, node size (catches layout changes between
+  // builds), scene hash, mesh paths and hashes. The payload hash follows.
+  void write_header(
+    std::string & buffer,
+    const std::uint64_t scene_hash,
+    const std::vector<std::string> & paths,
+    const std::vector<std::uint64_t> & hashes)
+  {
+    buffer.append(MAGIC,sizeof(MAGIC));
+    write_binary(buffer,VERSION);
+    write_binary(buffer,(std::uint32_t)sizeof(BVH::Node));
+    write_binary(buffer,scene_hash);
+    write_binary(buffer,(std::uint64_t)paths.size());
+    for(int i = 0;i<(int)paths.size();i++)
+    {
+      write_binary(buffer,paths[i]);
+      write_binary(buffer,hashes[i]);
+    }
+  }
+
+  bool read_header(BinaryReader & reader, const std::string & filename)
+  {
+    char magic[sizeof(MAGIC)];
+    std::uint32_t version, node_size;
+    std::uint64_t scene_hash, expected_hash, num_meshes;
+    if(!reader.read_bytes(magic,sizeof(magic)) ||
+      std::memcmp(magic,MAGIC,sizeof(MAGIC)) != 0 ||
+      !reader.read(version) || version != VERSION ||
+      !reader.read(node_size) || node_size != sizeof(BVH::Node) ||
+      !reader.read(expected_hash) ||
+      !file_content_hash(filename,scene_hash) ||
+      scene_hash != expected_hash ||
+      !reader.read(num_meshes))
+    {
+      return false;
+    }
+    for(std::uint64_t m = 0;m<num_meshes;m++)
+    {
+      std::string path;
+      std::uint64_t mesh_hash;
+      if(!reader.read(path) || !reader.read(expected_hash))
+      {
+        return false;
+      }
+      if(!is_absolute(path))
+      {
+        path = scene_directory(filename) + path;
+      }
+      if(!file_content_hash(path,mesh_hash) || mesh_hash != expected_hash)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Objects are written recursively (groups hold objects, instances place
+  // one). Materials, meshes and objects placed by instances may be shared:
+  // each is written in full where first met and referred to by index after
+  // that. An index equal to the number seen so far announces a new one,
+  // which follows.
+  struct ObjectWriter
+  {
+    std::string & payload;
+    std::map<const Material *,std::uint32_t> materials;
+    std::map<const TriangleMesh *,std::uint32_t> meshes;
+    std::map<const Object *,std::uint32_t> placed;
+
+    // Returns false if the object (or one inside it) is of an unknown type
+    bool write(const Object & object)
+    {
+      if(typeid(object) == typeid(Sphere))
+      {
+        const Sphere & sphere = static_cast<const Sphere &>(object);
+        write_header(SPHERE,object);
+        write_binary(payload,sphere.center);
+        write_binary(payload,sphere.radius);
+      }else if(typeid(object) == typeid(Plane))
+      {
+        const Plane & plane = static_cast<const Plane &>(object);
+        write_header(PLANE,object);
+        write_binary(payload,plane.point);
+        write_binary(payload,plane.normal);
+      }else if(typeid(object) == typeid(Triangle))
+      {
+        const Triangle & triangle = static_cast<const Triangle &>(object);
+        write_header(TRIANGLE,object);
+        write_binary(payload,std::get<0>(triangle.corners));
+        write_binary(payload,std::get<1>(triangle.corners));
+        write_binary(payload,std::get<2>(triangle.corners));
+      }else if(typeid(object) == typeid(TriangleSoup))
+      {
+        const TriangleSoup & soup = static_cast<const TriangleSoup &>(object);
+        if(soup.mesh)
+        {
+          write_header(SOUP,object);
+          write_mesh(*soup.mesh);
+          return true;
+        }
+        write_header(GROUP,object);
+        write_binary(payload,(std::uint64_t)soup.triangles.size());
+        for(const auto & member : soup.triangles)
+        {
+          if(!write(*member))
+          {
+            return false;
+          }
+        }
+        write_hierarchy(soup.bvh);
+      }else if(typeid(object) == typeid(Instance))
+      {
+        const Instance & instance = static_cast<const Instance &>(object);
+        if(!instance.object)
+        {
+          return false;
+        }
+        write_header(INSTANCE,object);
+        const Eigen::Matrix<double,3,4> transform =
+          instance.transform().matrix().topRows<3>();
+        write_binary(payload,transform);
+        const auto found = placed.find(instance.object.get());
+        if(found != placed.end())
+        {
+          write_binary(payload,found->second);
+          return true;
+        }
+        // Objects placed inside this one are numbered first, as the reader
+        // only knows an object once it has read all of it
+        write_binary(payload,(std::uint32_t)placed.size());
+        if(!write(*instance.object))
+        {
+          return false;
+        }
+        const std::uint32_t index = placed.size();
+        placed[instance.object.get()] = index;
+        return true;
+      }else
+      {
+        return false;
+      }
+      return true;
+    }
+
+    void write_header(const ObjectType type, const Object & object)
+    {
+      write_binary(payload,(std::uint8_t)type);
+      const Material * material = object.material.get();
+      if(!material)
+      {
+        write_binary(payload,(std::int32_t)-1);
+        return;
+      }
+      const auto found = materials.find(material);
+      if(found != materials.end())
+      {
+        write_binary(payload,(std::int32_t)found->second);
+        return;
+      }
+      const std::uint32_t index = materials.size();
+      materials[material] = index;
+      write_binary(payload,(std::int32_t)index);
+      write_binary(payload,material->ka);
+      write_binary(payload,material->kd);
+      write_binary(payload,material->ks);
+      write_binary(payload,material->km);
+      write_binary(payload,material->phong_exponent);
+      write_binary(payload,(std::uint8_t)material->is_checkerboard);
+      write_binary(payload,(std::uint8_t)material->is_noise);
+    }
+
+    void write_mesh(const TriangleMesh & mesh)
+    {
+      const auto found = meshes.find(&mesh);
+      if(found != meshes.end())
+      {
+        write_binary(payload,found->second);
+        return;
+      }
+      const std::uint32_t index = meshes.size();
+      meshes[&mesh] = index;
+      write_binary(payload,index);
+      write_binary(payload,mesh.vertices);
+      write_binary(payload,mesh.faces);
+      write_binary(payload,mesh.num_triangles);
+      write_binary(payload,mesh.cache_key);
+      write_hierarchy(mesh.bvh);
+    }
+
+    // Hierarchy and whether it is compressed (compressed nodes are
+    // rebuilt on reading, see read_hierarchy)
+    void write_hierarchy(const BVH & bvh)
+    {
+      bvh.write(payload);
+      write_binary(payload,(std::uint8_t)bvh.is_compressed());
+    }
+  };
+
+  // Reads what ObjectWriter wrote, checking every index and size
+  struct ObjectReader
+  {
+    BinaryReader & reader;
+    std::vector<std::shared_ptr<Material> > materials;
+    std::vector<std::shared_ptr<const TriangleMesh> > meshes;
+    std::vector<std::shared_ptr<const Object> > placed;
+
+    bool read(std::shared_ptr<Object> & object, const int depth)
+    {
+      std::uint8_t type;
+      std::shared_ptr<Material> material;
+      if(depth > MAX_NESTING ||
+        !reader.read(type) ||
+        !read_material(material))
+      {
+        return false;
+      }
+      bool valid = true;
+      if(type == SPHERE)
+      {
+        std::shared_ptr<Sphere> sphere(new Sphere());
+        valid = reader.read(sphere->center) && reader.read(sphere->radius);
+        object = sphere;
+      }else if(type == PLANE)
+      {
+        std::shared_ptr<Plane> plane(new Plane());
+        valid = reader.read(plane->point) && reader.read(plane->normal);
+        object = plane;
+      }else if(type == TRIANGLE)
+      {
+        std::shared_ptr<Triangle> triangle(new Triangle());
+        valid =
+          reader.read(std::get<0>(triangle->corners)) &&
+          reader.read(std::get<1>(triangle->corners)) &&
+          reader.read(std::get<2>(triangle->corners));
+        object = triangle;
+      }else if(type == SOUP)
+      {
+        std::shared_ptr<TriangleSoup> soup(new TriangleSoup());
+        valid = read_mesh(soup->mesh);
+        object = soup;
+      }else if(type == GROUP)
+      {
+        std::shared_ptr<TriangleSoup> soup(new TriangleSoup());
+        std::uint64_t count;
+        valid = reader.read(count);
+        for(std::uint64_t m = 0;valid && m<count;m++)
+        {
+          std::shared_ptr<Object> member;
+          valid = read(member,depth+1);
+          soup->triangles.push_back(member);
+        }
+        valid = valid && read_hierarchy(soup->bvh) &&
+          soup->bvh.indices.size() == count;
+        object = soup;
+      }else if(type == INSTANCE)
+      {
+        std::shared_ptr<Instance> instance(new Instance());
+        Eigen::Matrix<double,3,4> transform;
+        std::uint32_t index;
+        valid =
+          reader.read(transform) &&
+          reader.read(index) &&
+          index <= placed.size();
+        std::shared_ptr<const Object> placed_object;
+        if(valid && index == placed.size())
+        {
+          std::shared_ptr<Object> new_object;
+          valid = read(new_object,depth+1);
+          placed.push_back(new_object);
+          placed_object = new_object;
+        }else if(valid)
+        {
+          placed_object = placed[index];
+        }
+        if(valid)
+        {
+          Eigen::Affine3d affine = Eigen::Affine3d::Identity();
+          affine.matrix().topRows<3>() = transform;
+          instance->set_transform(affine);
+          instance->object = placed_object;
+        }
+        object = instance;
+      }else
+      {
+        valid = false;
+      }
+      if(valid)
+      {
+        object->material = material;
+      }
+      return valid;
+    }
+
+    bool read_material(std::shared_ptr<Material> & material)
+    {
+      std::int32_t index;
+      if(!reader.read(index) ||
+        index < -1 || index > (std::int64_t)materials.size())
+      {
+        return false;
+      }
+      if(index == -1)
+      {
+        return true;
+      }
+      if(index < (std::int64_t)materials.size())
+      {
+        material = materials[index];
+        return true;
+      }
+      material.reset(new Material());
+      std::uint8_t checkerboard = 0, noise = 0;
+      const bool valid =
+        reader.read(material->ka) &&
+        reader.read(material->kd) &&
+        reader.read(material->ks) &&
+        reader.read(material->km) &&
+        reader.read(material->phong_exponent) &&
+        reader.read(checkerboard) &&
+        reader.read(noise);
+      material->is_checkerboard = checkerboard;
+      material->is_noise = noise;
+      materials.push_back(material);
+      return valid;
+    }
+
+    bool read_mesh(std::shared_ptr<const TriangleMesh> & mesh)
+    {
+      std::uint32_t index;
+      if(!reader.read(index) || index > meshes.size())
+      {
+        return false;
+      }
+      if(index < meshes.size())
+      {
+        mesh = meshes[index];
+        return true;
+      }
+      std::shared_ptr<TriangleMesh> read_mesh(new TriangleMesh());
+      bool valid =
+        reader.read(read_mesh->vertices) &&
+        reader.read(read_mesh->faces) &&
+        read_mesh->faces.size() % 3 == 0 &&
+        reader.read(read_mesh->num_triangles) &&
+        read_mesh->num_triangles >= 0 &&
+        read_mesh->num_triangles <= read_mesh->num_slots() &&
+        reader.read(read_mesh->cache_key) &&
+        read_hierarchy(read_mesh->bvh) &&
+        (int)read_mesh->bvh.indices.size() == read_mesh->num_slots();
+      for(const std::uint32_t v : read_mesh->faces)
+      {
+        valid = valid && v < read_mesh->vertices.size();
+      }
+      mesh = read_mesh;
+      // Meshes of .stl files are shared with (and counted by) the mesh
+      // cache, like meshes read_json loads
+      if(valid && read_mesh->cache_key != 0)
+      {
+        mesh = mesh_cache().adopt(mesh);
+      }
+      meshes.push_back(mesh);
+      return valid;
+    }
+
+    bool read_hierarchy(BVH & bvh)
+    {
+      std::uint8_t compressed;
+      if(!bvh.read(reader) || !reader.read(compressed))
+      {
+        return false;
+      }
+      if(compressed)
+      {
+        bvh.compress();
+      }
+      return true;
+    }
+  };
+}
+
+bool read_scene_cache(
+  const std::string & filename,
+  Camera & camera,
+  std::vector<std::shared_ptr<Object> > & objects,
+  std::vector<std::shared_ptr<Light> > & lights,
+  BVH & scene_bvh)
+{
+  MappedFile file;
+  if(!file.open(cache_path(filename)))
+  {
+    return false;
+  }
+  BinaryReader reader{file.data(),file.data() + file.size()};
+  // Everything after the header is covered by a hash, so that a damaged
+  // file is never mistaken for a scene
+  std::uint64_t payload_hash;
+  if(!read_header(reader,filename) ||
+    !reader.read(payload_hash) ||
+    payload_hash != content_hash(reader.p,reader.end - reader.p))
+  {
+    return false;
+  }
+  objects.clear();
+  lights.clear();
+
+  bool valid =
+    reader.read(camera.e) &&
+    reader.read(camera.u) &&
+    reader.read(camera.v) &&
+    reader.read(camera.w) &&
+    reader.read(camera.d) &&
+    reader.read(camera.width) &&
+    reader.read(camera.height);
+
+  std::uint64_t num_lights = 0;
+  valid = valid && reader.read(num_lights);
+  for(std::uint64_t l = 0;valid && l<num_lights;l++)
+  {
+    std::uint8_t type = 0;
+    valid = reader.read(type);
+    if(valid && type == DIRECTIONAL)
+    {
+      std::shared_ptr<DirectionalLight> light(new DirectionalLight());
+      valid = reader.read(light->I) && reader.read(light->d);
+      lights.push_back(light);
+    }else if(valid && type == POINT)
+    {
+      std::shared_ptr<PointLight> light(new PointLight());
+      valid = reader.read(light->I) && reader.read(light->p);
+      lights.push_back(light);
+    }else
+    {
+      valid = false;
+    }
+  }
+
+  ObjectReader object_reader{reader,{},{},{}};
+  std::uint64_t num_objects = 0;
+  valid = valid && reader.read(num_objects);
+  for(std::uint64_t o = 0;valid && o<num_objects;o++)
+  {
+    std::shared_ptr<Object> object;
+    valid = object_reader.read(object,0);
+    if(valid)
+    {
+      objects.push_back(object);
+    }
+  }
+  valid = valid && scene_bvh.read(reader) && reader.p == reader.end;
+  if(!valid)
+  {
+    objects.clear();
+    lights.clear();
+  }
+  return valid;
+}
+
+bool write_scene_cache(
+  const std::string & filename,
+  const std::vector<std::string> & stl_files,
+  const Camera & camera,
+  const std::vector<std::shared_ptr<Object> > & objects,
+  const std::vector<std::shared_ptr<Light> > & lights,
+  const BVH & scene_bvh)
+{
+  std::uint64_t scene_hash;
+  if(!file_content_hash(filename,scene_hash))
+  {
+    return false;
+  }
+  const std::string directory = scene_directory(filename);
+  std::vector<std::string> paths;
+  std::vector<std::uint64_t> hashes;
+  for(const std::string & path : stl_files)
+  {
+    std::uint64_t hash;
+    if(!file_content_hash(path,hash))
+    {
+      return false;
+    }
+    paths.push_back(path.compare(0,directory.size(),directory) == 0 ?
+      path.substr(directory.size()) : path);
+    hashes.push_back(hash);
+  }
+
+  std::string payload;
+  write_binary(payload,camera.e);
+  write_binary(payload,camera.u);
+  write_binary(payload,camera.v);
+  write_binary(payload,camera.w);
+  write_binary(payload,camera.d);
+  write_binary(payload,camera.width);
+  write_binary(payload,camera.height);
+
+  write_binary(payload,(std::uint64_t)lights.size());
+  for(const auto & light : lights)
+  {
+    const Light & l = *light;
+    if(typeid(l) == typeid(DirectionalLight))
+    {
+      write_binary(payload,(std::uint8_t)DIRECTIONAL);
+      write_binary(payload,l.I);
+      write_binary(payload,static_cast<const DirectionalLight &>(l).d);
+    }else if(typeid(l) == typeid(PointLight))
+    {
+      write_binary(payload,(std::uint8_t)POINT);
+      write_binary(payload,l.I);
+      write_binary(payload,static_cast<const PointLight &>(l).p);
+    }else
+    {
+      return false;
+    }
+  }
+
+  ObjectWriter object_writer{payload,{},{},{}};
+  write_binary(payload,(std::uint64_t)objects.size());
+  for(const auto & object : objects)
+  {
+    if(!object_writer.write(*object))
+    {
+      return false;
+    }
+  }
+  scene_bvh.write(payload);
+  std::string buffer;
+  write_header(buffer,scene_hash,paths,hashes);
+  write_binary(buffer,content_hash(payload.data(),payload.size()));
+  buffer += payload;
+
+  // Write next to the final name and rename, so that a concurrent reader
+  // never sees a half written cache
+  const std::string path = cache_path(filename);
+  const std::string temporary = path + ".tmp";
+  FILE * file = std::fopen(temporary.c_str(),"wb");
+  if(!file)
+  {
+    return false;
+  }
+  const bool written =
+    std::fwrite(buffer.data(),1,buffer.size(),file) == buffer.size();
+  if(std::fclose(file) != 0 || !written ||
+    std::rename(temporary.c_str(),path.c_str()) != 0)
+  {
+    std::remove(temporary.c_str());
+    return false;
+  }
+  return true;
+}
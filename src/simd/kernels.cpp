@@ -0,0 +1,735 @@
+// SIMD kernels (see simd_kernels.h). This file is compiled once per
+// instruction set, each time with the matching compiler flags and with
+// SIMD_ISA naming the set; the kernels of each copy are published through
+// simd_kernels_<SIMD_ISA>(). Everything else has internal linkage.
+//
+// Only raw doubles and intrinsics are allowed here: no Eigen, no standard
+// library templates, nothing defined inline in a header that other
+// (baseline) translation units also instantiate.
+#include "simd_kernels.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__)
+#  include <immintrin.h>
+#endif
+
+#ifndef SIMD_ISA
+#  define SIMD_ISA baseline
+#endif
+#define SIMD_CONCAT2(a,b) a##b
+#define SIMD_CONCAT(a,b) SIMD_CONCAT2(a,b)
+
+namespace
+{
+  // Thin wrappers around the intrinsics of each instruction set, so that the
+  // kernels below are written only once. vd holds LANES doubles, vm a
+  // per-lane mask.
+#if defined(__AVX512F__)
+  const int LANES = 8;
+  typedef __m512d vd;
+  typedef __mmask8 vm;
+  inline vd set1(const double x) { return _mm512_set1_pd(x); }
+  inline vd load(const double * p) { return _mm512_loadu_pd(p); }
+  inline void store(double * p, const vd a) { _mm512_storeu_pd(p,a); }
+  inline vd add(const vd a, const vd b) { return _mm512_add_pd(a,b); }
+  inline vd sub(const vd a, const vd b) { return _mm512_sub_pd(a,b); }
+  inline vd mul(const vd a, const vd b) { return _mm512_mul_pd(a,b); }
+  inline vd div(const vd a, const vd b) { return _mm512_div_pd(a,b); }
+  inline vd sqrt(const vd a) { return _mm512_sqrt_pd(a); }
+  inline vd min(const vd a, const vd b) { return _mm512_min_pd(a,b); }
+  inline vd max(const vd a, const vd b) { return _mm512_max_pd(a,b); }
+  inline vm lt(const vd a, const vd b)
+    { return _mm512_cmp_pd_mask(a,b,_CMP_LT_OQ); }
+  inline vm le(const vd a, const vd b)
+    { return _mm512_cmp_pd_mask(a,b,_CMP_LE_OQ); }
+  inline vm gt(const vd a, const vd b)
+    { return _mm512_cmp_pd_mask(a,b,_CMP_GT_OQ); }
+  inline vm ge(const vd a, const vd b)
+    { return _mm512_cmp_pd_mask(a,b,_CMP_GE_OQ); }
+  inline vm mask_and(const vm a, const vm b) { return a & b; }
+  inline vm mask_or(const vm a, const vm b) { return a | b; }
+  inline vm mask_andnot(const vm a, const vm b) { return ~a & b; }
+  // Lane-wise m ? a : b
+  inline vd select(const vm m, const vd a, const vd b)
+    { return _mm512_mask_blend_pd(m,b,a); }
+  inline int bits(const vm m) { return m; }
+  // Truncate to int32
+  inline void store_int(int * p, const vd a)
+    { _mm256_storeu_si256((__m256i *)p,_mm512_cvttpd_epi32(a)); }
+  // Convert LANES bytes to doubles
+  inline vd load_bytes(const unsigned char * p)
+  {
+    return _mm512_cvtepi32_pd(
+      _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)));
+  }
+#elif defined(__AVX__)
+  const int LANES = 4;
+  typedef __m256d vd;
+  typedef __m256d vm;
+  inline vd set1(const double x) { return _mm256_set1_pd(x); }
+  inline vd load(const double * p) { return _mm256_loadu_pd(p); }
+  inline void store(double * p, const vd a) { _mm256_storeu_pd(p,a); }
+  inline vd add(const vd a, const vd b) { return _mm256_add_pd(a,b); }
+  inline vd sub(const vd a, const vd b) { return _mm256_sub_pd(a,b); }
+  inline vd mul(const vd a, const vd b) { return _mm256_mul_pd(a,b); }
+  inline vd div(const vd a, const vd b) { return _mm256_div_pd(a,b); }
+  inline vd sqrt(const vd a) { return _mm256_sqrt_pd(a); }
+  inline vd min(const vd a, const vd b) { return _mm256_min_pd(a,b); }
+  inline vd max(const vd a, const vd b) { return _mm256_max_pd(a,b); }
+  inline vm lt(const vd a, const vd b) { return _mm256_cmp_pd(a,b,_CMP_LT_OQ); }
+  inline vm le(const vd a, const vd b) { return _mm256_cmp_pd(a,b,_CMP_LE_OQ); }
+  inline vm gt(const vd a, const vd b) { return _mm256_cmp_pd(a,b,_CMP_GT_OQ); }
+  inline vm ge(const vd a, const vd b) { return _mm256_cmp_pd(a,b,_CMP_GE_OQ); }
+  inline vm mask_and(const vm a, const vm b) { return _mm256_and_pd(a,b); }
+  inline vm mask_or(const vm a, const vm b) { return _mm256_or_pd(a,b); }
+  inline vm mask_andnot(const vm a, const vm b)
+    { return _mm256_andnot_pd(a,b); }
+  inline vd select(const vm m, const vd a, const vd b)
+    { return _mm256_blendv_pd(b,a,m); }
+  inline int bits(const vm m) { return _mm256_movemask_pd(m); }
+  inline void store_int(int * p, const vd a)
+    { _mm_storeu_si128((__m128i *)p,_mm256_cvttpd_epi32(a)); }
+  inline vd load_bytes(const unsigned char * p)
+  {
+    int bytes;
+    memcpy(&bytes,p,sizeof(bytes));
+    return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+  }
+#elif defined(__SSE2__)
+  const int LANES = 2;
+  typedef __m128d vd;
+  typedef __m128d vm;
+  inline vd set1(const double x) { return _mm_set1_pd(x); }
+  inline vd load(const double * p) { return _mm_loadu_pd(p); }
+  inline void store(double * p, const vd a) { _mm_storeu_pd(p,a); }
+  inline vd add(const vd a, const vd b) { return _mm_add_pd(a,b); }
+  inline vd sub(const vd a, const vd b) { return _mm_sub_pd(a,b); }
+  inline vd mul(const vd a, const vd b) { return _mm_mul_pd(a,b); }
+  inline vd div(const vd a, const vd b) { return _mm_div_pd(a,b); }
+  inline vd sqrt(const vd a) { return _mm_sqrt_pd(a); }
+  inline vd min(const vd a, const vd b) { return _mm_min_pd(a,b); }
+  inline vd max(const vd a, const vd b) { return _mm_max_pd(a,b); }
+  inline vm lt(const vd a, const vd b) { return _mm_cmplt_pd(a,b); }
+  inline vm le(const vd a, const vd b) { return _mm_cmple_pd(a,b); }
+  inline vm gt(const vd a, const vd b) { return _mm_cmpgt_pd(a,b); }
+  inline vm ge(const vd a, const vd b) { return _mm_cmpge_pd(a,b); }
+  inline vm mask_and(const vm a, const vm b) { return _mm_and_pd(a,b); }
+  inline vm mask_or(const vm a, const vm b) { return _mm_or_pd(a,b); }
+  inline vm mask_andnot(const vm a, const vm b) { return _mm_andnot_pd(a,b); }
+  // SSE2 has no blend: select with and/andnot/or
+  inline vd select(const vm m, const vd a, const vd b)
+    { return _mm_or_pd(_mm_and_pd(m,a),_mm_andnot_pd(m,b)); }
+  inline int bits(const vm m) { return _mm_movemask_pd(m); }
+  inline void store_int(int * p, const vd a)
+    { _mm_storel_epi64((__m128i *)p,_mm_cvttpd_epi32(a)); }
+  inline vd load_bytes(const unsigned char * p)
+    { return _mm_set_pd(p[1],p[0]); }
+#else
+  const int LANES = 1;
+  typedef double vd;
+  typedef bool vm;
+  inline vd set1(const double x) { return x; }
+  inline vd load(const double * p) { return *p; }
+  inline void store(double * p, const vd a) { *p = a; }
+  inline vd add(const vd a, const vd b) { return a + b; }
+  inline vd sub(const vd a, const vd b) { return a - b; }
+  inline vd mul(const vd a, const vd b) { return a * b; }
+  inline vd div(const vd a, const vd b) { return a / b; }
+  inline vd sqrt(const vd a) { return ::sqrt(a); }
+  // Same NaN behavior as the SSE instructions: return b unless a < b
+  inline vd min(const vd a, const vd b) { return a < b ? a : b; }
+  inline vd max(const vd a, const vd b) { return a > b ? a : b; }
+  inline vm lt(const vd a, const vd b) { return a < b; }
+  inline vm le(const vd a, const vd b) { return a <= b; }
+  inline vm gt(const vd a, const vd b) { return a > b; }
+  inline vm ge(const vd a, const vd b) { return a >= b; }
+  inline vm mask_and(const vm a, const vm b) { return a && b; }
+  inline vm mask_or(const vm a, const vm b) { return a || b; }
+  inline vm mask_andnot(const vm a, const vm b) { return !a && b; }
+  inline vd select(const vm m, const vd a, const vd b) { return m ? a : b; }
+  inline int bits(const vm m) { return m ? 1 : 0; }
+  inline void store_int(int * p, const vd a) { *p = (int)a; }
+  inline vd load_bytes(const unsigned char * p) { return *p; }
+#endif
+
+  // Bit mask of the lanes of a vector starting at slot k that lie before end
+  inline int lanes_before(const int k, const int end)
+  {
+    return end - k >= LANES ? (1<<LANES) - 1 : (1<<(end - k)) - 1;
+  }
+
+  // Lowest set bit
+  inline int first_lane(const int mask)
+  {
+    int lane = 0;
+    while(!(mask & (1<<lane)))
+    {
+      lane++;
+    }
+    return lane;
+  }
+
+  // Ordered a != b (false if either is NaN)
+  inline vm ne(const vd a, const vd b)
+  {
+    return mask_or(lt(a,b),gt(a,b));
+  }
+
+  // Parametric distance of the nearest root >= min_t for the spheres of the
+  // vector starting at slot k, NaN where there is none (so that a miss fails
+  // every comparison, even against an infinite max_t). Same operations, in
+  // the same order, as Sphere::intersect (Eigen sums a 3-vector dot product
+  // as x0 + (x1 + x2)).
+  inline vd sphere_roots(
+    const SimdRay & ray,
+    const double min_t,
+    const double * cx,
+    const double * cy,
+    const double * cz,
+    const double * r,
+    const int k)
+  {
+    const double * d = ray.direction;
+    const vd dx = set1(d[0]);
+    const vd dy = set1(d[1]);
+    const vd dz = set1(d[2]);
+    const vd ocx = sub(set1(ray.origin[0]),load(cx+k));
+    const vd ocy = sub(set1(ray.origin[1]),load(cy+k));
+    const vd ocz = sub(set1(ray.origin[2]),load(cz+k));
+    const vd rr = load(r+k);
+    const vd b = add(mul(dx,ocx),add(mul(dy,ocy),mul(dz,ocz)));
+    const vd oc2 = add(mul(ocx,ocx),add(mul(ocy,ocy),mul(ocz,ocz)));
+    const vd a = set1(d[0]*d[0] + (d[1]*d[1] + d[2]*d[2]));
+    const vd disc = sub(mul(b,b),mul(a,sub(oc2,mul(rr,rr))));
+    // sqrt of a negative discriminant is NaN, which fails both tests below
+    const vd sq = sqrt(disc);
+    const vd nb = sub(set1(0),b);
+    const vd t1 = div(add(nb,sq),a);
+    const vd t2 = div(sub(nb,sq),a);
+    const vd lo = set1(min_t);
+    return select(ge(t2,lo),t2,select(ge(t1,lo),t1,set1(NAN)));
+  }
+
+  int sphere_closest_hit(
+    const SimdRay & ray, const double min_t,
+    const double * cx, const double * cy, const double * cz, const double * r,
+    const int begin, const int end, double * max_t)
+  {
+    int closest = -1;
+    double t[LANES];
+    for(int k = begin;k<end;k += LANES)
+    {
+      const vd roots = sphere_roots(ray,min_t,cx,cy,cz,r,k);
+      int mask = bits(lt(roots,set1(*max_t))) & lanes_before(k,end);
+      if(!mask)
+      {
+        continue;
+      }
+      store(t,roots);
+      for(int lane = 0;lane<LANES;lane++)
+      {
+        // Later lanes must still beat the max_t updated by earlier ones
+        if((mask & (1<<lane)) && t[lane] < *max_t)
+        {
+          *max_t = t[lane];
+          closest = k + lane;
+        }
+      }
+    }
+    return closest;
+  }
+
+  bool sphere_any_hit(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const double * cx, const double * cy, const double * cz, const double * r,
+    const int begin, const int end)
+  {
+    const vd hi = set1(max_t);
+    for(int k = begin;k<end;k += LANES)
+    {
+      const vd roots = sphere_roots(ray,min_t,cx,cy,cz,r,k);
+      if(bits(le(roots,hi)) & lanes_before(k,end))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Watertight test of the triangles of the vector starting at slot k (see
+  // intersect_triangle, whose operations this repeats in the same order).
+  // Returns the lanes that are hit with t >= min_t.
+  inline vm triangle_hits(
+    const SimdTriangleRay & ray,
+    const double min_t,
+    const double * const * corners,
+    const int k,
+    vd & t,
+    vd & V,
+    vd & W,
+    vd & det)
+  {
+    const double * const * a = corners;
+    const double * const * b = corners + 3;
+    const double * const * c = corners + 6;
+    const vd ox = set1(ray.origin[ray.kx]);
+    const vd oy = set1(ray.origin[ray.ky]);
+    const vd oz = set1(ray.origin[ray.kz]);
+    const vd sx = set1(ray.sx);
+    const vd sy = set1(ray.sy);
+    // Corners relative to the ray origin
+    const vd Az = sub(load(a[ray.kz]+k),oz);
+    const vd Bz = sub(load(b[ray.kz]+k),oz);
+    const vd Cz = sub(load(c[ray.kz]+k),oz);
+    // Shear and scale the corners
+    const vd ax = sub(sub(load(a[ray.kx]+k),ox),mul(sx,Az));
+    const vd ay = sub(sub(load(a[ray.ky]+k),oy),mul(sy,Az));
+    const vd bx = sub(sub(load(b[ray.kx]+k),ox),mul(sx,Bz));
+    const vd by = sub(sub(load(b[ray.ky]+k),oy),mul(sy,Bz));
+    const vd cx = sub(sub(load(c[ray.kx]+k),ox),mul(sx,Cz));
+    const vd cy = sub(sub(load(c[ray.ky]+k),oy),mul(sy,Cz));
+    // Scaled barycentric coordinates (edge functions)
+    const vd U = sub(mul(cx,by),mul(cy,bx));
+    V = sub(mul(ax,cy),mul(ay,cx));
+    W = sub(mul(bx,ay),mul(by,ax));
+    const vd zero = set1(0);
+    const vm negative = mask_or(mask_or(lt(U,zero),lt(V,zero)),lt(W,zero));
+    const vm positive = mask_or(mask_or(gt(U,zero),gt(V,zero)),gt(W,zero));
+    det = add(add(U,V),W);
+    const vd T = mul(set1(ray.sz),add(add(mul(U,Az),mul(V,Bz)),mul(W,Cz)));
+    t = div(T,det);
+    return mask_andnot(
+      mask_and(negative,positive),
+      mask_and(ne(det,zero),ge(t,set1(min_t))));
+  }
+
+  // Closest-hit update for one vector of triangles: corners (offset by k)
+  // hold slots [slot,slot+LANES), of which those before end count
+  inline void closest_triangle_lanes(
+    const SimdTriangleRay & ray,
+    const double min_t,
+    const double * const * corners,
+    const int k,
+    const int slot,
+    const int end,
+    double * max_t,
+    double * u,
+    double * v,
+    int & closest)
+  {
+    vd tk, Vk, Wk, detk;
+    const vm hit = triangle_hits(ray,min_t,corners,k,tk,Vk,Wk,detk);
+    const int mask =
+      bits(mask_and(hit,lt(tk,set1(*max_t)))) & lanes_before(slot,end);
+    if(!mask)
+    {
+      return;
+    }
+    double t[LANES], V[LANES], W[LANES], det[LANES];
+    store(t,tk);
+    store(V,Vk);
+    store(W,Wk);
+    store(det,detk);
+    for(int lane = 0;lane<LANES;lane++)
+    {
+      if((mask & (1<<lane)) && t[lane] < *max_t)
+      {
+        *max_t = t[lane];
+        *u = V[lane] / det[lane];
+        *v = W[lane] / det[lane];
+        closest = slot + lane;
+      }
+    }
+  }
+
+  // Any-hit test of one vector of triangles (see closest_triangle_lanes)
+  inline bool any_triangle_lanes(
+    const SimdTriangleRay & ray,
+    const double min_t,
+    const double max_t,
+    const double * const * corners,
+    const int k,
+    const int slot,
+    const int end)
+  {
+    vd t, V, W, det;
+    const vm hit = triangle_hits(ray,min_t,corners,k,t,V,W,det);
+    return bits(mask_and(hit,le(t,set1(max_t)))) & lanes_before(slot,end);
+  }
+
+  int triangle_closest_hit(
+    const SimdTriangleRay & ray, const double min_t,
+    const double * const * corners,
+    const int begin, const int end, double * max_t, double * u, double * v)
+  {
+    int closest = -1;
+    for(int k = begin;k<end;k += LANES)
+    {
+      closest_triangle_lanes(ray,min_t,corners,k,k,end,max_t,u,v,closest);
+    }
+    return closest;
+  }
+
+  bool triangle_any_hit(
+    const SimdTriangleRay & ray, const double min_t, const double max_t,
+    const double * const * corners,
+    const int begin, const int end)
+  {
+    for(int k = begin;k<end;k += LANES)
+    {
+      if(any_triangle_lanes(ray,min_t,max_t,corners,k,k,end))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Gather the corners of the indexed triangles in slots [slot,slot+LANES)
+  // into structure-of-arrays form, NaN past end
+  struct GatheredTriangles
+  {
+    double coordinates[9][LANES];
+    const double * corners[9];
+
+    GatheredTriangles(
+      const double * vertices,
+      const std::uint32_t * faces,
+      const int slot,
+      const int end)
+    {
+      for(int lane = 0;lane<LANES;lane++)
+      {
+        for(int c = 0;c<3;c++)
+        {
+          const double * p = slot + lane < end ?
+            vertices + 3*(std::size_t)faces[3*(slot+lane)+c] : nullptr;
+          for(int k = 0;k<3;k++)
+          {
+            coordinates[3*c+k][lane] = p ? p[k] : NAN;
+          }
+        }
+      }
+      for(int q = 0;q<9;q++)
+      {
+        corners[q] = coordinates[q];
+      }
+    }
+  };
+
+  int indexed_triangle_closest_hit(
+    const SimdTriangleRay & ray, const double min_t,
+    const double * vertices, const std::uint32_t * faces,
+    const int begin, const int end, double * max_t, double * u, double * v)
+  {
+    int closest = -1;
+    for(int slot = begin;slot<end;slot += LANES)
+    {
+      const GatheredTriangles gathered(vertices,faces,slot,end);
+      closest_triangle_lanes(
+        ray,min_t,gathered.corners,0,slot,end,max_t,u,v,closest);
+    }
+    return closest;
+  }
+
+  bool indexed_triangle_any_hit(
+    const SimdTriangleRay & ray, const double min_t, const double max_t,
+    const double * vertices, const std::uint32_t * faces,
+    const int begin, const int end)
+  {
+    for(int slot = begin;slot<end;slot += LANES)
+    {
+      const GatheredTriangles gathered(vertices,faces,slot,end);
+      if(any_triangle_lanes(
+        ray,min_t,max_t,gathered.corners,0,slot,end))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Watertight test of one triangle with corners a, b, c against the packet
+  // rays of the vector starting at ray k: triangle_hits with rays instead of
+  // triangles in the lanes, and the same operations in the same order
+  inline vm packet_triangle_hits(
+    const SimdTrianglePacket & packet,
+    const double min_t,
+    const double * a,
+    const double * b,
+    const double * c,
+    const int k,
+    vd & t,
+    vd & V,
+    vd & W,
+    vd & det)
+  {
+    const vd ox = load(packet.ox+k);
+    const vd oy = load(packet.oy+k);
+    const vd oz = load(packet.oz+k);
+    const vd sx = load(packet.sx+k);
+    const vd sy = load(packet.sy+k);
+    // Corners relative to the ray origins
+    const vd Az = sub(set1(a[packet.kz]),oz);
+    const vd Bz = sub(set1(b[packet.kz]),oz);
+    const vd Cz = sub(set1(c[packet.kz]),oz);
+    // Shear and scale the corners
+    const vd ax = sub(sub(set1(a[packet.kx]),ox),mul(sx,Az));
+    const vd ay = sub(sub(set1(a[packet.ky]),oy),mul(sy,Az));
+    const vd bx = sub(sub(set1(b[packet.kx]),ox),mul(sx,Bz));
+    const vd by = sub(sub(set1(b[packet.ky]),oy),mul(sy,Bz));
+    const vd cx = sub(sub(set1(c[packet.kx]),ox),mul(sx,Cz));
+    const vd cy = sub(sub(set1(c[packet.ky]),oy),mul(sy,Cz));
+    // Scaled barycentric coordinates (edge functions)
+    const vd U = sub(mul(cx,by),mul(cy,bx));
+    V = sub(mul(ax,cy),mul(ay,cx));
+    W = sub(mul(bx,ay),mul(by,ax));
+    const vd zero = set1(0);
+    const vm negative = mask_or(mask_or(lt(U,zero),lt(V,zero)),lt(W,zero));
+    const vm positive = mask_or(mask_or(gt(U,zero),gt(V,zero)),gt(W,zero));
+    det = add(add(U,V),W);
+    const vd T =
+      mul(load(packet.sz+k),add(add(mul(U,Az),mul(V,Bz)),mul(W,Cz)));
+    t = div(T,det);
+    return mask_andnot(
+      mask_and(negative,positive),
+      mask_and(ne(det,zero),ge(t,set1(min_t))));
+  }
+
+  bool indexed_triangle_packet_closest_hit(
+    const SimdTrianglePacket & packet, const double min_t,
+    const double * vertices, const std::uint32_t * faces,
+    const int begin, const int end, const int first, const int last,
+    double * max_t, double * u, double * v, int * closest)
+  {
+    bool found = false;
+    double t[LANES], V[LANES], W[LANES], det[LANES];
+    // Triangles in slot order, so that the lowest slot wins ties like in
+    // indexed_triangle_closest_hit
+    for(int slot = begin;slot<end;slot++)
+    {
+      const double * a = vertices + 3*(std::size_t)faces[3*slot];
+      const double * b = vertices + 3*(std::size_t)faces[3*slot+1];
+      const double * c = vertices + 3*(std::size_t)faces[3*slot+2];
+      for(int k = first;k<last;k += LANES)
+      {
+        vd tk, Vk, Wk, detk;
+        const vm hit =
+          packet_triangle_hits(packet,min_t,a,b,c,k,tk,Vk,Wk,detk);
+        const int mask = bits(hit) & lanes_before(k,last);
+        if(!mask)
+        {
+          continue;
+        }
+        store(t,tk);
+        store(V,Vk);
+        store(W,Wk);
+        store(det,detk);
+        for(int lane = 0;lane<LANES;lane++)
+        {
+          const int r = k + lane;
+          if((mask & (1<<lane)) && t[lane] < max_t[r])
+          {
+            max_t[r] = t[lane];
+            u[r] = V[lane] / det[lane];
+            v[r] = W[lane] / det[lane];
+            closest[r] = slot;
+            found = true;
+          }
+        }
+      }
+    }
+    return found;
+  }
+
+  // Parametric distance of the planes of the vector starting at slot k (see
+  // Plane::hit). Returns the lanes with a hit beyond min_t.
+  inline vm plane_hits(
+    const SimdRay & ray,
+    const double min_t,
+    const double * const * planes,
+    const int k,
+    vd & t)
+  {
+    const vd nx = load(planes[0]+k);
+    const vd ny = load(planes[1]+k);
+    const vd nz = load(planes[2]+k);
+    const vd px = sub(load(planes[3]+k),set1(ray.origin[0]));
+    const vd py = sub(load(planes[4]+k),set1(ray.origin[1]));
+    const vd pz = sub(load(planes[5]+k),set1(ray.origin[2]));
+    const vd denominator = add(mul(nx,set1(ray.direction[0])),
+      add(mul(ny,set1(ray.direction[1])),mul(nz,set1(ray.direction[2]))));
+    t = div(add(mul(nx,px),add(mul(ny,py),mul(nz,pz))),denominator);
+    return mask_and(ne(denominator,set1(0)),gt(t,set1(min_t)));
+  }
+
+  int plane_closest_hit(
+    const SimdRay & ray, const double min_t,
+    const double * const * planes,
+    const int begin, const int end, double * max_t)
+  {
+    int closest = -1;
+    double t[LANES];
+    for(int k = begin;k<end;k += LANES)
+    {
+      vd tk;
+      const vm hit = plane_hits(ray,min_t,planes,k,tk);
+      const int mask =
+        bits(mask_and(hit,lt(tk,set1(*max_t)))) & lanes_before(k,end);
+      if(!mask)
+      {
+        continue;
+      }
+      store(t,tk);
+      for(int lane = 0;lane<LANES;lane++)
+      {
+        if((mask & (1<<lane)) && t[lane] < *max_t)
+        {
+          *max_t = t[lane];
+          closest = k + lane;
+        }
+      }
+    }
+    return closest;
+  }
+
+  bool plane_any_hit(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const double * const * planes,
+    const int begin, const int end)
+  {
+    const vd hi = set1(max_t);
+    for(int k = begin;k<end;k += LANES)
+    {
+      vd t;
+      const vm hit = plane_hits(ray,min_t,planes,k,t);
+      if(bits(mask_and(hit,le(t,hi))) & lanes_before(k,end))
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Slab test of one vector of boxes with corners lo, hi (x,y,z). Stores
+  // the entry distances in t_enter and returns the lanes hit.
+  inline vm slab_hits(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const vd * lo, const vd * hi, double * t_enter)
+  {
+    const vd pad = set1(1.0 + 4.0 * DBL_EPSILON);
+    vd t0 = set1(min_t);
+    vd t1 = set1(max_t);
+    for(int a = 0;a<3;a++)
+    {
+      const vd origin = set1(ray.origin[a]);
+      const vd inv_direction = set1(ray.direction[a]);
+      const vd t_min = mul(sub(lo[a],origin),inv_direction);
+      const vd t_max = mul(sub(hi[a],origin),inv_direction);
+      // Swap only where t_min > t_max, and let NaNs fail the updates, like
+      // the scalar test
+      const vm swap = gt(t_min,t_max);
+      const vd t_near = select(swap,t_max,t_min);
+      const vd t_far = mul(select(swap,t_min,t_max),pad);
+      t0 = select(gt(t_near,t0),t_near,t0);
+      t1 = select(lt(t_far,t1),t_far,t1);
+    }
+    store(t_enter,t0);
+    return le(t0,t1);
+  }
+
+  int box_hits(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const double * const * bounds, const int count, double * t_enter)
+  {
+    int mask = 0;
+    for(int k = 0;k<count;k += LANES)
+    {
+      vd lo[3], hi[3];
+      for(int a = 0;a<3;a++)
+      {
+        lo[a] = load(bounds[a]+k);
+        hi[a] = load(bounds[a+3]+k);
+      }
+      mask |= (bits(slab_hits(ray,min_t,max_t,lo,hi,t_enter+k)) &
+        lanes_before(k,count)) << k;
+    }
+    return mask;
+  }
+
+  int quantized_box_hits(
+    const SimdRay & ray, const double min_t, const double max_t,
+    const float * origin, const float * scale,
+    const unsigned char * bounds, const int count, double * t_enter)
+  {
+    int mask = 0;
+    for(int k = 0;k<count;k += LANES)
+    {
+      vd lo[3], hi[3];
+      for(int a = 0;a<3;a++)
+      {
+        const vd o = set1(origin[a]);
+        const vd s = set1(scale[a]);
+        lo[a] = add(o,mul(load_bytes(bounds+a*SIMD_MAX_LANES+k),s));
+        hi[a] = add(o,mul(load_bytes(bounds+(a+3)*SIMD_MAX_LANES+k),s));
+      }
+      mask |= (bits(slab_hits(ray,min_t,max_t,lo,hi,t_enter+k)) &
+        lanes_before(k,count)) << k;
+    }
+    return mask;
+  }
+
+  void quantize(const double * in, const int count, unsigned char * out)
+  {
+    const vd zero = set1(0);
+    const vd one = set1(1);
+    const vd scale = set1(255);
+    int bytes[LANES];
+    int k = 0;
+    for(;k+LANES<=count;k += LANES)
+    {
+      store_int(bytes,mul(scale,max(min(load(in+k),one),zero)));
+      for(int lane = 0;lane<LANES;lane++)
+      {
+        out[k+lane] = bytes[lane];
+      }
+    }
+    for(;k<count;k++)
+    {
+      const double x = in[k] < 1 ? in[k] : 1;
+      out[k] = (int)(255.0*(x > 0 ? x : 0));
+    }
+  }
+
+  const SimdKernels kernels = {
+#if defined(__AVX512F__)
+    "avx512",
+#elif defined(__AVX2__)
+    "avx2",
+#elif defined(__AVX__)
+    "avx",
+#elif defined(__SSE2__)
+    "sse2",
+#else
+    "scalar",
+#endif
+    LANES,
+    sphere_closest_hit,
+    sphere_any_hit,
+    triangle_closest_hit,
+    triangle_any_hit,
+    indexed_triangle_closest_hit,
+    indexed_triangle_any_hit,
+    indexed_triangle_packet_closest_hit,
+    plane_closest_hit,
+    plane_any_hit,
+    box_hits,
+    quantized_box_hits,
+    quantize};
+}
+
+const SimdKernels * SIMD_CONCAT(simd_kernels_,SIMD_ISA)()
+{
+  return &kernels;
+}
@@ -0,0 +1,86 @@
+#include "simd_kernels.h"
+
+// One copy of the kernels per instruction set the build enabled (see
+// CMakeLists.txt); the baseline copy always exists
+const SimdKernels * simd_kernels_baseline();
+#ifdef SIMD_HAVE_AVX2
+const SimdKernels * simd_kernels_avx2();
+#endif
+#ifdef SIMD_HAVE_AVX512
+const SimdKernels * simd_kernels_avx512();
+#endif
+
+namespace
+{
+  // Kernels for isa if built and supported by this CPU, else null
+  const SimdKernels * find_kernels(const std::string & isa)
+  {
+    if(isa == simd_kernels_baseline()->isa)
+    {
+      return simd_kernels_baseline();
+    }
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  ifdef SIMD_HAVE_AVX2
+    if(isa == "avx2" && __builtin_cpu_supports("avx2"))
+    {
+      return simd_kernels_avx2();
+    }
+#  endif
+#  ifdef SIMD_HAVE_AVX512
+    if(isa == "avx512" && __builtin_cpu_supports("avx512f"))
+    {
+      return simd_kernels_avx512();
+    }
+#  endif
+#endif
+    return nullptr;
+  }
+
+  // Widest first
+  const char * const PREFERENCE[] = {"avx512","avx2"};
+
+  const SimdKernels * & active_kernels()
+  {
+    static const SimdKernels * active = []()
+    {
+      for(const char * isa : PREFERENCE)
+      {
+        if(const SimdKernels * kernels = find_kernels(isa))
+        {
+          return kernels;
+        }
+      }
+      return simd_kernels_baseline();
+    }();
+    return active;
+  }
+}
+
+const SimdKernels & simd_kernels()
+{
+  return *active_kernels();
+}
+
+bool select_simd_kernels(const std::string & isa)
+{
+  const SimdKernels * kernels = find_kernels(isa);
+  if(!kernels)
+  {
+    return false;
+  }
+  active_kernels() = kernels;
+  return true;
+}
+
+std::string available_simd_kernels()
+{
+  std::string names;
+  for(const char * isa : PREFERENCE)
+  {
+    if(find_kernels(isa))
+    {
+      names += std::string(isa) + " ";
+    }
+  }
+  return names + simd_kernels_baseline()->isa;
+}
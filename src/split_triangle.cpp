@@ -0,0 +1,47 @@
+#include "split_triangle.h"
+#include <limits>
+
+void split_triangle(
+  const Eigen::Vector3d & a,
+  const Eigen::Vector3d & b,
+  const Eigen::Vector3d & c,
+  const int axis,
+  const double position,
+  Eigen::AlignedBox3d & left,
+  Eigen::AlignedBox3d & right)
+{
+  left.setEmpty();
+  right.setEmpty();
+  const Eigen::Vector3d * corners[3] = {&a,&b,&c};
+  for(int i = 0;i<3;i++)
+  {
+    const Eigen::Vector3d & p = *corners[i];
+    const Eigen::Vector3d & q = *corners[(i+1)%3];
+    if(p(axis) <= position)
+    {
+      left.extend(p);
+    }
+    if(p(axis) >= position)
+    {
+      right.extend(p);
+    }
+    if((p(axis) < position && q(axis) > position) ||
+      (p(axis) > position && q(axis) < position))
+    {
+      // Where the edge crosses the plane, widened on the other axes by a
+      // bound on the interpolation's rounding error
+      const double t = (position - p(axis)) / (q(axis) - p(axis));
+      Eigen::Vector3d crossing = p + t*(q - p);
+      Eigen::Vector3d slack =
+        4*std::numeric_limits<double>::epsilon()*
+        (p.cwiseAbs() + q.cwiseAbs());
+      crossing(axis) = position;
+      slack(axis) = 0;
+      for(Eigen::AlignedBox3d * box : {&left,&right})
+      {
+        box->extend(Eigen::Vector3d(crossing - slack));
+        box->extend(Eigen::Vector3d(crossing + slack));
+      }
+    }
+  }
+}
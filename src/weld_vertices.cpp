@@ -0,0 +1,56 @@
+#include "weld_vertices.h"
+#include <cstring>
+
+namespace
+{
+  // Hash of a position's bit pattern (with -0 folded onto +0, which compares
+  // equal)
+  std::uint64_t hash_position(const Eigen::Vector3d & p)
+  {
+    std::uint64_t h = 0x9E3779B97F4A7C15ull;
+    for(int k = 0;k<3;k++)
+    {
+      const double x = p(k) == 0 ? 0.0 : p(k);
+      std::uint64_t bits;
+      std::memcpy(&bits,&x,sizeof(bits));
+      h = (h ^ bits) * 0xFF51AFD7ED558CCDull;
+      h ^= h >> 32;
+    }
+    return h;
+  }
+}
+
+void weld_vertices(
+  const std::vector<Eigen::Vector3d> & corners,
+  std::vector<Eigen::Vector3d> & vertices,
+  std::vector<std::uint32_t> & faces)
+{
+  vertices.clear();
+  faces.resize(corners.size());
+  // Open addressing table of vertex indices, at most half full
+  std::size_t capacity = 16;
+  while(capacity < 2*corners.size())
+  {
+    capacity *= 2;
+  }
+  const std::uint32_t EMPTY = 0xFFFFFFFFu;
+  std::vector<std::uint32_t> table(capacity,EMPTY);
+  // Closed meshes have about half as many vertices as faces
+  vertices.reserve(corners.size()/4);
+  for(std::size_t c = 0;c<corners.size();c++)
+  {
+    const Eigen::Vector3d & p = corners[c];
+    std::size_t slot = hash_position(p) & (capacity-1);
+    while(table[slot] != EMPTY && vertices[table[slot]] != p)
+    {
+      slot = (slot + 1) & (capacity-1);
+    }
+    if(table[slot] == EMPTY)
+    {
+      table[slot] = vertices.size();
+      vertices.push_back(p);
+    }
+    faces[c] = table[slot];
+  }
+  vertices.shrink_to_fit();
+}
@@ -1,5 +1,5 @@
 #include "write_ppm.h"
-#include <fstream>
+#include <cstdio>
 #include <cassert>
 #include <iostream>
 
@@ -8,39 +8,51 @@ bool write_ppm(
   const std::vector<unsigned char> & data,
   const int width,
   const int height,
-  const int num_channels)
+  const int num_channels,
+  const bool ascii)
 {
   ////////////////////////////////////////////////////////////////////////////
   // Replace with your code here:
-  // Open file and insert PPM header format
-  std::ofstream f;
-  f.open(filename);
-  
-  // First line: PPM format
-  if (num_channels == 1)  // P2 for grayscale images
-    f << "P2" << std::endl;
-  else  // P3 for color RGB images
-    f << "P3" << std::endl;
-  // Second line: filename (optional)
-  f << "#" << filename << std::endl;
-  // Third line: width and height
-  f << width << " " << height << std::endl;
-  // Fourth line: max pixel value
-  f << "255" << std::endl;
-  
-  // Insert content (pixel values) into PPM file
-  unsigned int loc = 0; // pixel location
-  for (unsigned int i = 0; i < height; i ++){
-    for (unsigned int j = 0; j < width; j ++){
-      loc = i * width + j;
-      for (unsigned int k = 0; k < num_channels; k++){
-        f << (unsigned int) data[loc*num_channels+k] << " ";
-      }
+  assert(
+    (num_channels == 3 || num_channels ==1 ) &&
+    ".ppm only supports RGB or grayscale images");
+  assert(data.size() >= (size_t)width*height*num_channels);
+
+  // PPM header: magic number, filename comment, width and height, max value
+  //   P5 / P6  binary grayscale / rgb
+  //   P2 / P3  ascii grayscale / rgb
+  std::string buffer;
+  if (num_channels == 1)
+    buffer = ascii ? "P2\n" : "P5\n";
+  else
+    buffer = ascii ? "P3\n" : "P6\n";
+  buffer += "#" + filename + "\n";
+  buffer += std::to_string(width) + " " + std::to_string(height) + "\n";
+  buffer += "255\n";
+
+  // Pixel values, row by row, follow the header in the same buffer so that
+  // the whole file goes out in a single write
+  const size_t num_values = (size_t)width * height * num_channels;
+  if (ascii) {
+    buffer.reserve(buffer.size() + 4 * num_values);
+    char value[8];
+    for (size_t i = 0; i < num_values; i ++){
+      const int len = std::snprintf(value, sizeof(value), "%u ", data[i]);
+      buffer.append(value, len);
     }
+  } else {
+    buffer.append(reinterpret_cast<const char *>(data.data()), num_values);
   }
 
-  // Close file and return
-  f.close();
-  return true;
+  std::FILE * f = std::fopen(filename.c_str(), "wb");
+  if (f == NULL) {
+    std::cerr << "IOError: " << filename << " could not be opened" << std::endl;
+    return false;
+  }
+  // Unbuffered: hand the whole buffer to the OS at once
+  std::setvbuf(f, NULL, _IONBF, 0);
+  const bool written =
+    std::fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+  return (std::fclose(f) == 0) && written;
   ////////////////////////////////////////////////////////////////////////////
 }